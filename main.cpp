@@ -4,38 +4,489 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <iomanip>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+#include <cstring>
+#include <charconv>
+#include <cmath>
+#include <random>
+#include <type_traits>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#endif
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 using namespace std;
 
-// Seat class to represent each seat on the airplane
+// USDT probes for bpftrace/perf (provider "airflight"). Each probe compiles
+// to a nop plus an ELF note, so it costs nothing until a tracer attaches:
+//   bpftrace -e 'usdt:./oop_airflight:airflight:book__done { @[arg3] = count(); }'
+// Flights are identified by their date and flight number strings.
+#ifdef STAP_PROBEV
+#define AIRFLIGHT_PROBE(name, ...) STAP_PROBEV(airflight, name, __VA_ARGS__)
+#else
+#define AIRFLIGHT_PROBE(name, ...) do {} while (0)
+#endif
+
+// Money is kept in integer cents throughout
+typedef int64_t Cents;
+
+// Parses "100", "100$", "$99.5" or "99.50" into cents. Amounts that do
+// not fit in Cents are invalid like any other malformed amount.
+static Cents parseCents(const string& text) {
+    string digits;
+    for (char c : text) {
+        if (c != '$') digits += c;
+    }
+    size_t dot = digits.find('.');
+    string whole = digits.substr(0, dot);
+    string fraction = dot == string::npos ? "" : digits.substr(dot + 1);
+    if (whole.empty() || whole.find_first_not_of("0123456789") != string::npos
+        || fraction.size() > 2 || fraction.find_first_not_of("0123456789") != string::npos) {
+        throw std::invalid_argument("Invalid amount: " + text);
+    }
+    while (fraction.size() < 2) fraction += '0';
+    whole.erase(0, min(whole.find_first_not_of('0'), whole.size() - 1));
+    const Cents maxWhole = (numeric_limits<Cents>::max() - 99) / 100;
+    if (whole.size() > to_string(maxWhole).size() || stoll(whole) > maxWhole) {
+        throw std::invalid_argument("Amount too large: " + text);
+    }
+    return Cents(stoll(whole)) * 100 + stoi(fraction);
+}
+
+// Formats cents the way prices have always been shown: "30", "12.50"
+static string formatCents(Cents amount) {
+    string sign = amount < 0 ? "-" : "";
+    Cents magnitude = amount < 0 ? -amount : amount;
+    string text = sign + to_string(magnitude / 100);
+    if (magnitude % 100) {
+        char fraction[4];
+        snprintf(fraction, sizeof(fraction), ".%02d", int(magnitude % 100));
+        text += fraction;
+    }
+    return text;
+}
+
+// Subsystems whose heap usage is tracked for `stats memory`
+enum class MemoryTag { Airplanes, Seats, Passengers, Tickets, Indexes, Ledger, Count };
+
+static const char* const memoryTagNames[] = {"airplanes", "seats", "passengers", "tickets", "indexes", "ledger"};
+
+// Live heap bytes and blocks per subsystem
+struct MemoryUsage {
+    atomic<int64_t> bytes{0};
+    atomic<int64_t> blocks{0};
+};
+
+static MemoryUsage memoryUsage[int(MemoryTag::Count)];
+
+// std allocator that charges every allocation to a subsystem
+template <typename T, MemoryTag Tag>
+struct CountingAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef CountingAllocator<U, Tag> other;
+    };
+
+    CountingAllocator() noexcept {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U, Tag>&) noexcept {}
+
+    T* allocate(size_t n) {
+        T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+        memoryUsage[int(Tag)].bytes.fetch_add(int64_t(n * sizeof(T)), memory_order_relaxed);
+        memoryUsage[int(Tag)].blocks.fetch_add(1, memory_order_relaxed);
+        return p;
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        memoryUsage[int(Tag)].bytes.fetch_sub(int64_t(n * sizeof(T)), memory_order_relaxed);
+        memoryUsage[int(Tag)].blocks.fetch_sub(1, memory_order_relaxed);
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U, Tag>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const CountingAllocator<U, Tag>&) const noexcept { return false; }
+};
+
+// Heap bytes a string holds beyond its inline (small string) buffer
+static size_t stringHeapBytes(const string& s) {
+    static const size_t inlineCapacity = string().capacity();
+    return s.capacity() > inlineCapacity ? s.capacity() + 1 : 0;
+}
+
+// Console output is queued instead of written on the calling thread, so a
+// slow terminal or pipe never stalls a booking. `Console() << ...` packs its
+// arguments into fixed-size binary records (literals by pointer, numbers and
+// money as raw values, other strings copied) and ConsoleWriter formats and
+// writes them from a background thread.
+struct Money {
+    Cents amount;  // rendered like formatCents()
+};
+
+struct LogRecord {
+    enum Arg : uint8_t { Literal, Text, HeapText, Signed, Unsigned, Character, Real, Amount };
+    static const size_t Capacity = 254;
+
+    uint16_t used = 0;
+    uint8_t data[Capacity];
+};
+
+// Appends the text of `record` to `out`, releasing any heap strings
+static void formatRecord(const LogRecord& record, string& out) {
+    const uint8_t* p = record.data;
+    const uint8_t* end = record.data + record.used;
+    char digits[32];
+    while (p < end) {
+        uint8_t arg = *p++;
+        switch (arg) {
+            case LogRecord::Literal: {
+                const char* literal;
+                memcpy(&literal, p, sizeof(literal));
+                p += sizeof(literal);
+                out += literal;
+                break;
+            }
+            case LogRecord::Text: {
+                uint8_t length = *p++;
+                out.append(reinterpret_cast<const char*>(p), length);
+                p += length;
+                break;
+            }
+            case LogRecord::HeapText: {
+                string* text;
+                memcpy(&text, p, sizeof(text));
+                p += sizeof(text);
+                out += *text;
+                delete text;
+                break;
+            }
+            case LogRecord::Signed: {
+                int64_t v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                out.append(digits, to_chars(digits, digits + sizeof(digits), v).ptr);
+                break;
+            }
+            case LogRecord::Unsigned: {
+                uint64_t v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                out.append(digits, to_chars(digits, digits + sizeof(digits), v).ptr);
+                break;
+            }
+            case LogRecord::Character:
+                out += char(*p++);
+                break;
+            case LogRecord::Real: {
+                double v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                ostringstream text;
+                text << v;
+                out += text.str();
+                break;
+            }
+            case LogRecord::Amount: {
+                Cents v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                out += formatCents(v);
+                break;
+            }
+        }
+    }
+}
+
+// Single-producer ring of records owned by one thread. A full ring makes
+// the producer yield until the writer catches up; output is never dropped.
+struct LogRing {
+    static const size_t Slots = 4096;
+
+    vector<LogRecord> records;
+    atomic<size_t> head{0};
+    atomic<size_t> tail{0};
+    atomic<uint64_t> pushed{0};
+    atomic<uint64_t> stalls{0};
+
+    LogRing() : records(Slots) {}
+
+    void push(const LogRecord& record) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) >= Slots) {
+            stalls.fetch_add(1, memory_order_relaxed);
+            while (h - tail.load(memory_order_acquire) >= Slots) this_thread::yield();
+        }
+        records[h & (Slots - 1)] = record;
+        head.store(h + 1, memory_order_release);
+        pushed.fetch_add(1, memory_order_relaxed);
+    }
+};
+
+// Registry of every thread's ring plus the writer's wakeup
+class ConsoleQueues {
+public:
+    static void push(const LogRecord& record) {
+        if (capture) {
+            formatRecord(record, *capture);
+            return;
+        }
+        localRing().push(record);
+        // A missed wakeup only delays output until the writer's poll timeout
+        if (writerIdle.load(memory_order_relaxed)) {
+            lock_guard<mutex> guard(wakeMutex);
+            wake.notify_one();
+        }
+    }
+
+    // Redirects this thread's console output into `sink`; nullptr restores it
+    static void captureInto(string* sink) {
+        capture = sink;
+    }
+
+    static vector<shared_ptr<LogRing>> rings() {
+        lock_guard<mutex> guard(registryMutex);
+        return registry;
+    }
+
+    static size_t ringCount() {
+        return registeredRings.load(memory_order_acquire);
+    }
+
+    static void waitForRecords(const vector<shared_ptr<LogRing>>& known, chrono::milliseconds timeout) {
+        unique_lock<mutex> lock(wakeMutex);
+        writerIdle.store(true, memory_order_seq_cst);
+        bool pending = ringCount() != known.size();
+        for (const auto& ring : known) {
+            if (ring->head.load(memory_order_acquire) != ring->tail.load(memory_order_relaxed)) pending = true;
+        }
+        if (!pending) wake.wait_for(lock, timeout);
+        writerIdle.store(false, memory_order_relaxed);
+    }
+
+private:
+    inline static mutex registryMutex;
+    inline static vector<shared_ptr<LogRing>> registry;
+    inline static atomic<size_t> registeredRings{0};
+    inline static atomic<bool> writerIdle{false};
+    inline static mutex wakeMutex;
+    inline static condition_variable wake;
+    inline static thread_local string* capture = nullptr;
+
+    static LogRing& localRing() {
+        thread_local shared_ptr<LogRing> ring;
+        if (!ring) {
+            ring = make_shared<LogRing>();
+            lock_guard<mutex> guard(registryMutex);
+            registry.push_back(ring);
+            registeredRings.store(registry.size(), memory_order_release);
+        }
+        return *ring;
+    }
+};
+
+// Builds one line of console output and queues it when destroyed. Text is
+// copied into the record, since the writer formats it later on another
+// thread; only text wrapped in Console::literal() is stored by pointer.
+class Console {
+public:
+    // Text that lives for the whole program, e.g. a string literal
+    struct Literal {
+        const char* text;
+    };
+
+    static Literal literal(const char* text) {
+        return Literal{text};
+    }
+
+    Console() = default;
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    ~Console() {
+        if (record.used) ConsoleQueues::push(record);
+    }
+
+    Console& operator<<(Literal literal) {
+        return put(LogRecord::Literal, &literal.text, sizeof(literal.text));
+    }
+
+    Console& operator<<(const char* text) {
+        return putText(text, strlen(text));
+    }
+
+    Console& operator<<(const string& text) {
+        return putText(text.data(), text.size());
+    }
+
+    Console& operator<<(char c) {
+        return put(LogRecord::Character, &c, 1);
+    }
+
+    Console& operator<<(double value) {
+        return put(LogRecord::Real, &value, sizeof(value));
+    }
+
+    Console& operator<<(Money money) {
+        return put(LogRecord::Amount, &money.amount, sizeof(money.amount));
+    }
+
+    template <typename T, typename enable_if<is_integral<T>::value && !is_same<T, char>::value &&
+                                             !is_same<T, bool>::value, int>::type = 0>
+    Console& operator<<(T value) {
+        if (is_signed<T>::value) {
+            int64_t v = int64_t(value);
+            return put(LogRecord::Signed, &v, sizeof(v));
+        }
+        uint64_t v = uint64_t(value);
+        return put(LogRecord::Unsigned, &v, sizeof(v));
+    }
+
+private:
+    static const size_t InlineText = 64;
+
+    LogRecord record;
+
+    bool room(size_t bytes) const {
+        return record.used + bytes <= LogRecord::Capacity;
+    }
+
+    void append(uint8_t arg, const void* value, size_t size) {
+        // Lines longer than one record continue in the next; order is kept
+        if (!room(1 + size)) {
+            ConsoleQueues::push(record);
+            record.used = 0;
+        }
+        record.data[record.used++] = arg;
+        memcpy(record.data + record.used, value, size);
+        record.used += size;
+    }
+
+    Console& put(uint8_t arg, const void* value, size_t size) {
+        append(arg, value, size);
+        return *this;
+    }
+
+    Console& putText(const char* text, size_t size) {
+        if (size <= InlineText) {
+            if (!room(2 + size)) {
+                ConsoleQueues::push(record);
+                record.used = 0;
+            }
+            uint8_t length = uint8_t(size);
+            append(LogRecord::Text, &length, 1);
+            memcpy(record.data + record.used, text, size);
+            record.used += size;
+            return *this;
+        }
+        string* copy = new string(text, size);  // freed by the writer
+        return put(LogRecord::HeapText, &copy, sizeof(copy));
+    }
+};
+
+// Seat class to represent each seat on the airplane. Packed into four
+// bytes: 16-bit row, 8-bit column (0 = 'A') and a flags byte holding the
+// availability bit and a 7-bit index into the flight's price tier table.
 class Seat {
 public:
-    int number;
-    char letter;
-    bool available;
-    double price;
-    int row;
+    static const uint8_t AvailableBit = 0x80;
+    static const uint8_t TierMask = 0x7f;
+    static const int MaxRow = 65535;  // largest row `row` can hold
+
+    uint16_t row;
+    uint8_t column;
+    uint8_t flags;
+
+    Seat() : row(0), column(0), flags(AvailableBit) {}
+
+    Seat(int r, char letter, uint8_t tier)
+        : row(uint16_t(r)), column(uint8_t(letter - 'A')), flags(AvailableBit | (tier & TierMask)) {}
 
-    Seat() : number(0), letter('A'), available(true), price(0.0) {}
+    int number() const {
+        return row;
+    }
+
+    char letter() const {
+        return char('A' + column);
+    }
 
-    Seat(int num, char let, int r, double price) : number(num), letter(let), row(r), price(price), available(true) {}
+    // Flags are read by seqlock readers, hence the relaxed atomics
+    uint8_t tier() const {
+        return __atomic_load_n(&flags, __ATOMIC_RELAXED) & TierMask;
+    }
 
     void book() {
-        available = false;
+        __atomic_store_n(&flags, uint8_t(flags & ~AvailableBit), __ATOMIC_RELAXED);
     }
 
     bool isAvailable() const {
-        return available;
+        return __atomic_load_n(&flags, __ATOMIC_RELAXED) & AvailableBit;
     }
 
     void free() {
-        available = true;
+        __atomic_store_n(&flags, uint8_t(flags | AvailableBit), __ATOMIC_RELAXED);
     }
 };
 
+static_assert(sizeof(Seat) == 4, "Seat should pack into four bytes");
+
+// Parses the digits of a seat id ("12" of "12C"); false unless they are a
+// row a Seat can hold
+static bool parseRow(const string& digits, int& row) {
+    const char* end = digits.data() + digits.size();
+    auto result = from_chars(digits.data(), end, row);
+    return result.ec == errc() && result.ptr == end && row >= 0 && row <= Seat::MaxRow;
+}
+
+// Price band from a config line, e.g. "1-20 100$"
+struct PriceRange {
+    int rowStart;
+    int rowEnd;
+    Cents price;
+};
+
 // Ticket class
 class Ticket {
 public:
@@ -44,27 +495,30 @@ public:
     string flightNumber;
     string flightDate;
     Seat seat;
+    Cents price;  // what was paid, kept for the refund
 
-    Ticket() : ticketID(0), passengerName(""), flightNumber(""), flightDate(""), seat() {}
+    Ticket() : ticketID(0), passengerName(""), flightNumber(""), flightDate(""), seat(), price(0) {}
 
-    Ticket(int id,const string& passenger, const string& flight, const string& date, const Seat& s)
-        : ticketID(id),passengerName(passenger), flightNumber(flight), flightDate(date), seat(s) {}
+    Ticket(int id,const string& passenger, const string& flight, const string& date, const Seat& s, Cents paid)
+        : ticketID(id),passengerName(passenger), flightNumber(flight), flightDate(date), seat(s), price(paid) {}
 
     void viewTicket() const {
-        cout << "Ticket ID: " << ticketID << ", Passenger: " << passengerName
+        Console() << "Ticket ID: " << ticketID << ", Passenger: " << passengerName
              << ", Flight: " << flightNumber << ", Date: " << flightDate
-             << ", Seat: " << seat.number << ", Price: $" << seat.price << endl;
+             << ", Seat: " << seat.number() << ", Price: $" << Money{price} << "\n";
     }
 };
 
+typedef vector<Ticket, CountingAllocator<Ticket, MemoryTag::Tickets>> TicketList;
+
 // Passenger class
 class Passenger {
 public:
     string name;
-    double balance;
-    vector<Ticket> tickets; // list of tickets
+    Cents balance;
+    TicketList tickets; // list of tickets
 
-    Passenger(const string& passengerName, double initialBalance = 0.0) :
+    Passenger(const string& passengerName, Cents initialBalance = 0) :
     name(passengerName), balance(initialBalance) {}
 
     // Adds a ticket to the passenger's collection
@@ -74,7 +528,7 @@ public:
 
     // Show all tickets booked by the passenger
     void showTickets() const {
-        cout << "Tickets for " << name << ":\n";
+        Console() << "Tickets for " << name << ":\n";
         for (const auto& ticket : tickets) {
             ticket.viewTicket();  // Calls the Ticket class method to display ticket details
         }
@@ -100,376 +554,6048 @@ public:
         return false;
     }
     // Refund money to the passenger
-    void refundMoney(double amount) {
+    void refundMoney(Cents amount) {
         balance += amount;
-        cout << "Refunded $" << amount << " to " << name << ". New balance: $" << balance << endl;
+        Console() << "Refunded $" << Money{amount} << " to " << name << ". New balance: $" << Money{balance} << "\n";
     }
 };
 
-class Airplane {
-public:
-    string flightNumber;
-    string date;
-    int seatsPerRow;
-    map<string, Seat> seats;
+typedef vector<Passenger, CountingAllocator<Passenger, MemoryTag::Passengers>> PassengerList;
 
-    Airplane(const string& flightNum, const string& d, int seatsRow, const vector<Seat>& seatList)
-        : flightNumber(flightNum), date(d), seatsPerRow(seatsRow) {
-        for (const auto& seat : seatList) {
-            seats[to_string(seat.number) + seat.letter] = seat;
-        }
+// Popcount kernels over packed availability bitmaps. The widest kernel the
+// CPU supports is picked once at startup; the scalar loop is the fallback.
+static size_t popcountWordsScalar(const uint64_t* words, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += __builtin_popcountll(words[i]);
     }
+    return total;
+}
 
-    void addSeat(int seatNumber, char seatLetter, int row, double price) {
-        string seatKey = to_string(seatNumber) + seatLetter; // Creates a unique seat identifier
-        seats[seatKey] = Seat(seatNumber, seatLetter, row, price); // Now passes the row parameter
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("avx2")))
+static size_t popcountWordsAvx2(const uint64_t* words, size_t count) {
+    // Nibble lookup table + vpsadbw (Mula's algorithm)
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        __m256i lo = _mm256_and_si256(v, lowMask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+        __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
     }
+    size_t total = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1)
+                 + _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+    return total + popcountWordsScalar(words + i, count - i);
+}
 
-    bool isSeatAvailable(int row, char letter) const{
-        string seatKey = to_string(row) + letter; // Create a string key
-        auto it = seats.find(seatKey);
-        if (it != seats.end()) {
-            return it->second.isAvailable(); // Check if the seat is available
-        }
-        return false;
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static size_t popcountWordsAvx512(const uint64_t* words, size_t count) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
     }
-
-    bool bookSeat(int row, char letter) {
-        string seatKey = to_string(row) + letter;
-        auto it = seats.find(seatKey);
-        if (it != seats.end() && it->second.available) {
-            it->second.book();
-            return true;
-        }
-        return false;
+    if (i < count) {
+        __mmask8 tail = static_cast<__mmask8>((1u << (count - i)) - 1);
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(tail, words + i)));
     }
-
-    void returnSeat(int seatNumber, char seatLetter) {
-        string seatKey = to_string(seatNumber) + seatLetter; // Create string key
-        auto it = seats.find(seatKey);
-        if (it != seats.end()) {
-            it->second.free();
-        }
+    return _mm512_reduce_add_epi64(acc);
+}
+#elif defined(__aarch64__)
+static size_t popcountWordsNeon(const uint64_t* words, size_t count) {
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        uint8x16_t bytes = vcntq_u8(vreinterpretq_u8_u64(vld1q_u64(words + i)));
+        acc = vaddq_u64(acc, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(bytes))));
     }
+    return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) + popcountWordsScalar(words + i, count - i);
+}
+#endif
 
-    void displayAvailableSeats() const {
-        for (const auto& pair : seats) {
-            if (isSeatAvailable(pair.second.number, pair.second.letter)) { // Use string key
-                cout << "Seat " << pair.second.number << pair.second.letter << " is available at price $" << pair.second.price << endl;
-            }
-        }
-    }
+typedef size_t (*PopcountKernel)(const uint64_t*, size_t);
 
-};
+static PopcountKernel selectPopcountKernel() {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq")) return popcountWordsAvx512;
+    if (__builtin_cpu_supports("avx2")) return popcountWordsAvx2;
+#elif defined(__aarch64__)
+    return popcountWordsNeon;
+#endif
+    return popcountWordsScalar;
+}
 
-class File {
+static const PopcountKernel popcountWords = selectPopcountKernel();
+
+// Fixed-size bitmap, one bit per seat slot
+class SeatBitmap {
 public:
-    // Constructor opens the file
-    File(const char* filename, int flags) {
-        fileDescriptor = open(filename, flags);
-        if (fileDescriptor == -1) {
-            throw std::runtime_error("Failed to open file");
-        }
+    vector<uint64_t, CountingAllocator<uint64_t, MemoryTag::Seats>> words;
+    size_t size;
+
+    SeatBitmap() : size(0) {}
+
+    explicit SeatBitmap(size_t bits) : words((bits + 63) / 64, 0), size(bits) {}
+
+    // Single-bit access uses relaxed atomics so seqlock readers may look at
+    // the words while the (only) writer updates them
+    bool test(size_t bit) const {
+        return (__atomic_load_n(&words[bit >> 6], __ATOMIC_RELAXED) >> (bit & 63)) & 1;
     }
 
-    // Destructor closes the file
-    ~File() {
-        if (fileDescriptor != -1) {
-            close(fileDescriptor);
+    void set(size_t bit) {
+        uint64_t& word = words[bit >> 6];
+        __atomic_store_n(&word, word | (uint64_t(1) << (bit & 63)), __ATOMIC_RELAXED);
+    }
+
+    void clear(size_t bit) {
+        uint64_t& word = words[bit >> 6];
+        __atomic_store_n(&word, word & ~(uint64_t(1) << (bit & 63)), __ATOMIC_RELAXED);
+    }
+
+    // Copies the words into `out` (same size) with relaxed atomic loads
+    void copyTo(SeatBitmap& out) const {
+        for (size_t i = 0; i < words.size(); ++i) {
+            out.words[i] = __atomic_load_n(&words[i], __ATOMIC_RELAXED);
         }
     }
 
-    // Disable copy semantics to avoid double-close
-    File(const File&) = delete;
-    File& operator=(const File&) = delete;
+    // Number of set bits in the whole bitmap
+    size_t count() const {
+        return popcountWords(words.data(), words.size());
+    }
 
-    // Enable move semantics for transferring ownership
-    File(File&& other) noexcept : fileDescriptor(other.fileDescriptor) {
-        other.fileDescriptor = -1; // Nullify the moved-from object's file descriptor
+    // Number of set bits in [first, first + length)
+    size_t countRange(size_t first, size_t length) const {
+        if (length == 0) return 0;
+        size_t last = first + length - 1;
+        size_t firstWord = first >> 6, lastWord = last >> 6;
+        uint64_t headMask = ~uint64_t(0) << (first & 63);
+        uint64_t tailMask = ~uint64_t(0) >> (63 - (last & 63));
+        if (firstWord == lastWord) {
+            return __builtin_popcountll(words[firstWord] & headMask & tailMask);
+        }
+        size_t total = __builtin_popcountll(words[firstWord] & headMask)
+                     + __builtin_popcountll(words[lastWord] & tailMask);
+        return total + popcountWords(words.data() + firstWord + 1, lastWord - firstWord - 1);
     }
 
-    File& operator=(File&& other) noexcept {
-        if (this != &other) {
-            if (fileDescriptor != -1) {
-                close(fileDescriptor);
+    // Calls fn(bit) for every set bit in ascending order
+    template <typename Fn>
+    void forEachSet(Fn fn) const {
+        for (size_t w = 0; w < words.size(); ++w) {
+            uint64_t bits = words[w];
+            while (bits) {
+                fn((w << 6) + __builtin_ctzll(bits));
+                bits &= bits - 1;
             }
-            fileDescriptor = other.fileDescriptor;
-            other.fileDescriptor = -1;
         }
-        return *this;
     }
+};
 
-    // Reading from the file
-    ssize_t read(void* buffer, size_t size) {
-        return ::read(fileDescriptor, buffer, size);
+// Seat index math for a cabin whose row width is a compile-time constant.
+// Rows are padded to a byte, word or dword lane so a row never straddles
+// a bitmap word, and the row mask and shifts fold to constants.
+template <int Width>
+struct FixedRowLayout {
+    static_assert(Width > 0 && Width <= 32, "fixed layouts cover rows of up to 32 seats");
+    static constexpr int strideShift = Width <= 8 ? 3 : Width <= 16 ? 4 : 5;
+    static constexpr uint64_t rowMask = (uint64_t(1) << Width) - 1;
+
+    constexpr int width() const { return Width; }
+    constexpr size_t stride() const { return size_t(1) << strideShift; }
+
+    size_t index(size_t rowOffset, int column) const {
+        return (rowOffset << strideShift) + column;
     }
 
-    // Writing to the file
-    ssize_t write(const void* buffer, size_t size) {
-        return ::write(fileDescriptor, buffer, size);
+    size_t rowOffset(size_t index) const {
+        return index >> strideShift;
     }
 
-    // File descriptor accessor
-    int getFileDescriptor() const {
-        return fileDescriptor;
+    int column(size_t index) const {
+        return int(index & ((size_t(1) << strideShift) - 1));
     }
 
-private:
-    int fileDescriptor;
+    size_t countRow(const SeatBitmap& bitmap, size_t rowOffset) const {
+        size_t bit = rowOffset << strideShift;
+        return __builtin_popcountll((bitmap.words[bit >> 6] >> (bit & 63)) & rowMask);
+    }
 };
 
-class ConfigReader {
-public:
-    vector<Airplane> loadConfig(const string& configFile) {
-        vector<Airplane> airplanes;
-        File file(configFile.c_str(), O_RDONLY);
-        char buffer[4096];
-        ssize_t bytesRead;
-        string fileContent;
-        // ifstream file(configFile);
-        // if (!file.is_open()) {
-        //     cout << "Unable to open configuration file." << endl;
-        //     return airplanes;
-        // }
-
-        while ((bytesRead = file.read(buffer, sizeof(buffer))) > 0) {
-            fileContent.append(buffer, bytesRead);
-        }
+// Fallback for any other width, with the same padding rules applied at run
+// time. Rows wider than 64 seats are stored unpadded.
+struct RuntimeRowLayout {
+    int seats;
+    size_t rowStride;
 
-        // Handle case where file couldn't be read
-        if (bytesRead == -1) {
-            throw std::runtime_error("Error reading file");
+    explicit RuntimeRowLayout(int width) : seats(width), rowStride(width) {
+        for (size_t lane = 8; lane <= 64; lane <<= 1) {
+            if (size_t(width) <= lane) {
+                rowStride = lane;
+                break;
+            }
         }
-        istringstream ss(fileContent);
-        string line;
-        while (getline(ss, line)) {
-            stringstream lineStream(line);
-            string date, flightNumber;
-            int seatsPerRow;
-            lineStream >> date >> flightNumber >> seatsPerRow;
-
-            vector<Seat> seats;
-            int rowStart, rowEnd;
-            string priceStr;
-            double price;
+    }
 
-            while (lineStream >> rowStart ) {
-                char dash;
-                lineStream >> dash >> rowEnd >> priceStr;
+    int width() const { return seats; }
+    size_t stride() const { return rowStride; }
 
-                priceStr.erase(remove(priceStr.begin(), priceStr.end(), '$'), priceStr.end());
-                price = stod(priceStr);
+    size_t index(size_t rowOffset, int column) const {
+        return rowOffset * rowStride + column;
+    }
 
-                for (int row = rowStart; row <= rowEnd; ++row) {
-                    for (char letter = 'A'; letter < 'A' + seatsPerRow; ++letter) {
-                        seats.push_back(Seat(row, letter, row, price));
-                    }
-                }
-            }
+    size_t rowOffset(size_t index) const {
+        return index / rowStride;
+    }
 
-            // Add the airplane to the list with flight number, date, and seats
-            airplanes.push_back(Airplane(flightNumber, date, seatsPerRow, seats));
-        }
+    int column(size_t index) const {
+        return int(index % rowStride);
+    }
 
-        return airplanes;
+    size_t countRow(const SeatBitmap& bitmap, size_t rowOffset) const {
+        return bitmap.countRange(rowOffset * rowStride, seats);
     }
 };
 
-class Program {
-private:
-    vector<Airplane> airplanes;
-    vector<Passenger> passengers;
-    vector<Ticket> tickets;
+// Calls fn with the layout for the given row width, using a compile-time
+// specialization for the common cabin widths
+template <typename Fn>
+auto withRowLayout(int seatsPerRow, Fn&& fn) {
+    switch (seatsPerRow) {
+        case 4: return fn(FixedRowLayout<4>());
+        case 6: return fn(FixedRowLayout<6>());
+        case 9: return fn(FixedRowLayout<9>());
+        case 10: return fn(FixedRowLayout<10>());
+        default: return fn(RuntimeRowLayout(seatsPerRow > 0 ? seatsPerRow : 1));
+    }
+}
 
+// Optional span tracing, exported as Chrome / Perfetto trace-event JSON.
+// Every thread records into its own single-producer ring buffer; with
+// tracing off a span costs one relaxed load and a well-predicted branch.
+class Tracer {
 public:
-    Program(const string& configFile) {
-        ConfigReader configReader;
-        airplanes = configReader.loadConfig(configFile);
+    struct Event {
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    static bool enabled() {
+        return __builtin_expect(active.load(memory_order_relaxed), 0);
     }
 
-    // Find a passenger by name
-    Passenger* findPassenger(const string& name) {
-        for (auto& passenger : passengers) {
-            if (passenger.name == name) return &passenger;
-        }
-        return nullptr;
+    static void start() {
+        active.store(true, memory_order_relaxed);
     }
 
-    // Add a new passenger
-    void addPassenger(const string& name, double money) {
-        passengers.push_back(Passenger(name, money));
+    static void stop() {
+        active.store(false, memory_order_relaxed);
     }
 
-    // Book a ticket for a passenger
-    void bookTicket(const string& flightNumber, const string& date, const string& seatNumber, char seatLetter, const string& passengerName) {
-        for (auto& airplane : airplanes) {
-            if (airplane.flightNumber == flightNumber && airplane.date == date) {
-                if (airplane.bookSeat(stoi(seatNumber), seatLetter)) {
-                    Passenger* passenger = findPassenger(passengerName);
-                    if (!passenger) {
-                        passengers.push_back(Passenger(passengerName));
-                        passenger = &passengers.back();
-                    }
+    // Nanoseconds since process start, never 0
+    static uint64_t now() {
+        static const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count() + 1;
+    }
 
-                    int ticketID = rand(); // Generate a random ticket ID
-                    auto seat = airplane.seats.find(to_string(stoi(seatNumber)) + seatLetter)->second;
-                    Ticket ticket(ticketID, passengerName, flightNumber, date, seat);
-                    passenger->addTicket(ticket);
-                    tickets.push_back(ticket);
+    static void record(const char* name, uint64_t start, uint64_t end) {
+        localRing().push(Event{name, start, end});
+    }
 
-                    cout << "Ticket booked successfully. Ticket ID: " << ticketID << endl;
-                } else {
-                    cout << "Seat is unavailable or invalid.\n";
-                }
-                return;
+    // Drains every ring into a trace-event JSON document
+    static string exportJson(size_t* eventCount = nullptr, size_t* droppedCount = nullptr) {
+        lock_guard<mutex> guard(registryMutex);
+        ostringstream json;
+        json << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        size_t events = 0, dropped = 0;
+        bool first = true;
+        int pid = getpid();
+        for (const auto& ring : rings) {
+            json << (first ? "" : ",") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+                 << ",\"tid\":" << ring->threadId << ",\"args\":{\"name\":\"thread " << ring->threadId << "\"}}";
+            first = false;
+            size_t tail = ring->tail.load(memory_order_relaxed);
+            size_t head = ring->head.load(memory_order_acquire);
+            for (size_t i = tail; i < head; ++i) {
+                const Event& event = ring->events[i & (Ring::Capacity - 1)];
+                json << ",{\"name\":\"" << event.name << "\",\"cat\":\"airflight\",\"ph\":\"X\",\"pid\":" << pid
+                     << ",\"tid\":" << ring->threadId << ",\"ts\":" << fixed << setprecision(3) << event.start / 1000.0
+                     << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+                ++events;
             }
+            ring->tail.store(head, memory_order_release);
+            dropped += ring->dropped.exchange(0, memory_order_relaxed);
         }
-        cout << "Flight not found.\n";
+        json << "]}\n";
+        if (eventCount) *eventCount = events;
+        if (droppedCount) *droppedCount = dropped;
+        return json.str();
     }
 
+private:
+    // SPSC ring: the owning thread pushes, exportJson drains. When full,
+    // new events are dropped and counted rather than blocking the producer.
+    struct Ring {
+        static const size_t Capacity = 1 << 16;
+
+        vector<Event> events;
+        atomic<size_t> head{0};
+        atomic<size_t> tail{0};
+        atomic<size_t> dropped{0};
+        uint32_t threadId;
 
-    void checkAvailability(const string& flightNumber, const string& date) {
-        for (const auto& airplane : airplanes) {
-            if (airplane.flightNumber == flightNumber && airplane.date == date) {
-                cout << "Available seats for flight " << flightNumber << " on " << date << ":\n";
-                airplane.displayAvailableSeats();
+        explicit Ring(uint32_t id) : events(Capacity), threadId(id) {}
+
+        void push(const Event& event) {
+            size_t h = head.load(memory_order_relaxed);
+            if (h - tail.load(memory_order_acquire) >= Capacity) {
+                dropped.fetch_add(1, memory_order_relaxed);
                 return;
             }
+            events[h & (Capacity - 1)] = event;
+            head.store(h + 1, memory_order_release);
         }
-        cout << "Flight not found.\n";
-    }
+    };
 
-    void returnTicket(int ticketID) {
-        Ticket foundTicket;
-        Passenger* ticketOwner = nullptr;
+    inline static atomic<bool> active{false};
+    inline static mutex registryMutex;
+    inline static vector<shared_ptr<Ring>> rings;  // outlive their threads so they can still be dumped
 
-        // Find the passenger who owns the ticket
-        for (auto& passenger : passengers) {
-            if (passenger.findTicket(ticketID, foundTicket)) {
-                ticketOwner = &passenger;
+    static Ring& localRing() {
+        thread_local shared_ptr<Ring> ring;
+        if (!ring) {
+            lock_guard<mutex> guard(registryMutex);
+            ring = make_shared<Ring>(uint32_t(rings.size() + 1));
+            rings.push_back(ring);
+        }
+        return *ring;
+    }
+};
+
+// Records its lifetime as a span while tracing is on
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* spanName) : name(spanName), start(Tracer::enabled() ? Tracer::now() : 0) {}
+
+    ~TraceSpan() {
+        if (start) Tracer::record(name, start, Tracer::now());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+// Time spent waiting for a lock that was already held
+struct LockContention {
+    uint64_t contended = 0;   // acquisitions that had to wait
+    uint64_t waitNanos = 0;
+
+    LockContention& operator+=(const LockContention& other) {
+        contended += other.contended;
+        waitNanos += other.waitNanos;
+        return *this;
+    }
+};
+
+// std::mutex that accounts for contention. The uncontended path is a single
+// try_lock; only acquisitions that find the lock held read the clock.
+class ContendedMutex {
+public:
+    void lock() {
+        if (inner.try_lock()) return;
+        auto begin = chrono::steady_clock::now();
+        inner.lock();
+        waitNanos.fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count(),
+                            memory_order_relaxed);
+        contended.fetch_add(1, memory_order_relaxed);
+    }
+
+    bool try_lock() { return inner.try_lock(); }
+    void unlock() { inner.unlock(); }
+
+    LockContention contention() const {
+        LockContention result;
+        result.contended = contended.load(memory_order_relaxed);
+        result.waitNanos = waitNanos.load(memory_order_relaxed);
+        return result;
+    }
+
+private:
+    mutex inner;
+    atomic<uint64_t> contended{0};
+    atomic<uint64_t> waitNanos{0};
+};
+
+// Sequence lock for the read path. The writer, who already holds the
+// airplane mutex, makes the counter odd while it changes seat state;
+// readers copy what they need and retry if the counter moved.
+class SeqLock {
+public:
+    uint64_t readBegin() const {
+        uint64_t version;
+        while ((version = sequence.load(memory_order_acquire)) & 1) {
+            this_thread::yield();
+        }
+        return version;
+    }
+
+    bool readRetry(uint64_t version) const {
+        atomic_thread_fence(memory_order_acquire);
+        return sequence.load(memory_order_relaxed) != version;
+    }
+
+    void writeBegin() {
+        sequence.store(sequence.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
+
+    void writeEnd() {
+        sequence.store(sequence.load(memory_order_relaxed) + 1, memory_order_release);
+    }
+
+private:
+    atomic<uint64_t> sequence{0};
+};
+
+// One flight's availability in the shared-memory segment: the bitmap
+// words follow the struct. Other processes map the segment read-only and
+// read through seqLock, so both fields are lock-free atomics.
+struct AvailabilitySlot {
+    SeqLock seqLock;
+    atomic<uint64_t> freeSeats{0};
+    uint64_t wordCount = 0;
+
+    uint64_t* words() { return reinterpret_cast<uint64_t*>(this + 1); }
+    const uint64_t* words() const { return reinterpret_cast<const uint64_t*>(this + 1); }
+
+    // Copies words [firstWord, lastWord) of `bitmap`; the owning Airplane's
+    // lock keeps this single-writer
+    void publish(const uint64_t* bitmap, size_t firstWord, size_t lastWord, size_t freeCount) {
+        seqLock.writeBegin();
+        store(bitmap, firstWord, lastWord, freeCount);
+        seqLock.writeEnd();
+    }
+
+    // The copy itself, for callers already inside a seqLock write
+    void store(const uint64_t* bitmap, size_t firstWord, size_t lastWord, size_t freeCount) {
+        size_t count = __atomic_load_n(&wordCount, __ATOMIC_RELAXED);
+        for (size_t w = firstWord; w < lastWord && w < count; ++w) {
+            __atomic_store_n(&words()[w], __atomic_load_n(&bitmap[w], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        }
+        freeSeats.store(freeCount, memory_order_relaxed);
+    }
+};
+
+static_assert(atomic<uint64_t>::is_always_lock_free && atomic<uint32_t>::is_always_lock_free,
+              "the shared availability segment needs address-free atomics");
+
+// Immutable seat grid: which slots hold seats, their rows, letters and
+// price tiers. Flights with the same seatsPerRow and row ranges share one
+// layout through intern(); each Airplane keeps only its own availability
+// bits, counters and tier prices.
+class CabinLayout {
+public:
+    int seatsPerRow;
+    int firstRow;
+    int rowCount;
+    size_t rowStride;          // bitmap bits per row, from the row layout
+    vector<Seat, CountingAllocator<Seat, MemoryTag::Seats>> seats;  // dense grid, index = (row - firstRow) * rowStride + column
+    SeatBitmap configured;     // slots that hold a real seat
+    vector<pair<int, int>> rowRanges;  // the ranges it was built from, one per price tier
+
+    // Every price range gets its own tier, so repricing a range later is a
+    // single tier table store
+    CabinLayout(int seatsRow, const vector<PriceRange>& ranges) : seatsPerRow(seatsRow), firstRow(0), rowCount(0) {
+        rowStride = withRowLayout(seatsPerRow, [](auto layout) { return layout.stride(); });
+        if (ranges.empty()) return;
+        if (ranges.size() > Seat::TierMask + 1u) throw std::runtime_error("Too many price ranges");
+        int lowRow = ranges.front().rowStart, highRow = ranges.front().rowEnd;
+        for (const auto& range : ranges) {
+            lowRow = min(lowRow, range.rowStart);
+            highRow = max(highRow, range.rowEnd);
+        }
+        resizeRows(lowRow, highRow);
+        for (size_t tier = 0; tier < ranges.size(); ++tier) {
+            rowRanges.emplace_back(ranges[tier].rowStart, ranges[tier].rowEnd);
+            for (int row = ranges[tier].rowStart; row <= ranges[tier].rowEnd; ++row) {
+                for (int column = 0; column < seatsPerRow; ++column) {
+                    placeSeat(Seat(row, char('A' + column), uint8_t(tier)));
+                }
+            }
+        }
+    }
+
+    size_t slotCount() const {
+        return seats.size();
+    }
+
+    // Slot index of a seat, or -1 if it is not part of this cabin
+    int seatIndex(int row, char letter) const {
+        return withRowLayout(seatsPerRow, [&](auto layout) {
+            int column = letter - 'A';
+            if (row < firstRow || row >= firstRow + rowCount || column < 0 || column >= layout.width()) return -1;
+            size_t index = layout.index(row - firstRow, column);
+            return configured.test(index) ? int(index) : -1;
+        });
+    }
+
+    // Grows the grid to cover `row` and places the seat; only for layouts
+    // not yet shared. Returns how many slots the existing seats moved by.
+    size_t addSeat(const Seat& seat) {
+        size_t shift = 0;
+        if (rowCount == 0) {
+            resizeRows(seat.row, seat.row);
+        } else if (seat.row < firstRow || seat.row >= firstRow + rowCount) {
+            int oldFirstRow = firstRow;
+            resizeRows(min(int(seat.row), firstRow), max(int(seat.row), firstRow + rowCount - 1));
+            shift = size_t(oldFirstRow - firstRow) * rowStride;
+        }
+        placeSeat(seat);
+        return shift;
+    }
+
+    // The shared layout for this shape, built on first use. Layouts are
+    // found by a hash of the shape and dropped when the last flight using
+    // them goes away.
+    static shared_ptr<const CabinLayout> intern(int seatsPerRow, const vector<PriceRange>& ranges) {
+        uint64_t hash = 14695981039346656037ull;  // FNV-1a
+        auto mix = [&](int64_t value) {
+            for (int i = 0; i < 8; ++i) {
+                hash = (hash ^ uint8_t(value >> (8 * i))) * 1099511628211ull;
+            }
+        };
+        mix(seatsPerRow);
+        for (const auto& range : ranges) {
+            mix(range.rowStart);
+            mix(range.rowEnd);
+        }
+
+        Registry& registry = sharedLayouts();
+        lock_guard<mutex> guard(registry.mutex);
+        auto& bucket = registry.layouts[hash];
+        shared_ptr<const CabinLayout> found;
+        bucket.erase(remove_if(bucket.begin(), bucket.end(), [&](const weak_ptr<const CabinLayout>& entry) {
+            shared_ptr<const CabinLayout> layout = entry.lock();
+            if (layout && !found && layout->sameShape(seatsPerRow, ranges)) found = layout;
+            return !layout;
+        }), bucket.end());
+        if (found) return found;
+        auto layout = allocate_shared<const CabinLayout>(CountingAllocator<CabinLayout, MemoryTag::Seats>(), seatsPerRow, ranges);
+        bucket.push_back(layout);
+        return layout;
+    }
+
+private:
+    struct Registry {
+        std::mutex mutex;
+        unordered_map<uint64_t, vector<weak_ptr<const CabinLayout>>> layouts;  // by shape hash
+    };
+
+    static Registry& sharedLayouts() {
+        static Registry registry;
+        return registry;
+    }
+
+    bool sameShape(int otherSeatsPerRow, const vector<PriceRange>& ranges) const {
+        if (otherSeatsPerRow != seatsPerRow || ranges.size() != rowRanges.size()) return false;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            if (ranges[i].rowStart != rowRanges[i].first || ranges[i].rowEnd != rowRanges[i].second) return false;
+        }
+        return true;
+    }
+
+    // Re-lays the grid so that it covers rows [lowRow, highRow]
+    void resizeRows(int lowRow, int highRow) {
+        decltype(seats) oldSeats;
+        oldSeats.swap(seats);
+        SeatBitmap oldConfigured = configured;
+        int oldFirstRow = firstRow;
+
+        firstRow = lowRow;
+        rowCount = highRow - lowRow + 1;
+        size_t slots = size_t(rowCount) * rowStride;
+        seats.assign(slots, Seat());
+        configured = SeatBitmap(slots);
+
+        oldConfigured.forEachSet([&](size_t oldIndex) {
+            size_t index = oldIndex + size_t(oldFirstRow - firstRow) * rowStride;
+            seats[index] = oldSeats[oldIndex];
+            configured.set(index);
+        });
+    }
+
+    void placeSeat(const Seat& seat) {
+        int column = seat.column;
+        if (column >= seatsPerRow) return;
+        size_t index = size_t(seat.row - firstRow) * rowStride + column;
+        seats[index] = seat;
+        configured.set(index);
+    }
+};
+
+class Airplane {
+public:
+    string flightNumber;
+    string date;
+    shared_ptr<const CabinLayout> layout;  // seat grid, shared with flights of the same shape
+    vector<Cents, CountingAllocator<Cents, MemoryTag::Airplanes>> priceTiers;  // indexed by Seat::tier(); at most 128 entries
+    SeatBitmap availability;   // set while the seat is free
+    SeatBitmap held;           // set while an unexpired hold reserves the seat
+    atomic<size_t> freeSeats;  // number of set bits in availability
+    mutable ContendedMutex lock;  // serializes writers of seat state and prices
+    SeqLock seqLock;           // lets readers skip the mutex
+    AvailabilitySlot* sharedSlot = nullptr;  // mirror in the shared availability segment, guarded by lock
+
+    // Passenger waiting for a seat on a full flight
+    struct WaitlistEntry {
+        int priority;
+        uint64_t sequence;
+        string passengerName;
+
+        // Higher priority first, then first come first served
+        bool operator<(const WaitlistEntry& other) const {
+            if (priority != other.priority) return priority < other.priority;
+            return sequence > other.sequence;
+        }
+    };
+    priority_queue<WaitlistEntry> waitlist;  // guarded by lock
+    uint64_t waitlistSequence = 0;
+
+    // Ticket holding each booked seat, by seat index, so a checkpoint can
+    // write one flight without scanning every passenger. This and
+    // dirtyEpoch change together with the ticket, under Program's
+    // ledgerMutex rather than `lock`.
+    struct Occupant {
+        int ticketID;
+        uint32_t account;  // index into Program's passengers
+        Cents price;
+    };
+    map<int, Occupant, less<int>, CountingAllocator<pair<const int, Occupant>, MemoryTag::Indexes>> occupants;
+    uint64_t dirtyEpoch = 0;  // last checkpoint epoch in which a ticket changed
+
+    // The layout is chosen during construction (and addSeat, which is not
+    // safe once the airplane is shared). After that only availability bits,
+    // freeSeats and prices change, each inside a seqLock write section.
+    // Prices stay per flight so a reload can reprice one flight in place.
+    Airplane(const string& flightNum, const string& d, int seatsRow, const vector<PriceRange>& ranges)
+        : flightNumber(flightNum), date(d), freeSeats(0) {
+        if (ranges.size() > Seat::TierMask + 1u) throw std::runtime_error("Too many price ranges for flight " + flightNum);
+        layout = CabinLayout::intern(seatsRow, ranges);
+        for (const auto& range : ranges) priceTiers.push_back(range.price);
+        availability = SeatBitmap(layout->slotCount());
+        held = SeatBitmap(layout->slotCount());
+        resetAvailability();
+    }
+
+    // Copies the layout before changing it, since it may be shared
+    void addSeat(int seatNumber, char seatLetter, int row, Cents price) {
+        size_t tier = find(priceTiers.begin(), priceTiers.end(), price) - priceTiers.begin();
+        if (tier == priceTiers.size()) {
+            if (tier > Seat::TierMask) throw std::runtime_error("Too many price tiers on flight " + flightNumber);
+            priceTiers.push_back(price);
+        }
+        auto grown = make_shared<CabinLayout>(*layout);
+        size_t shift = grown->addSeat(Seat(seatNumber, seatLetter, uint8_t(tier)));
+        SeatBitmap grownAvailability(grown->slotCount()), grownHeld(grown->slotCount());
+        availability.forEachSet([&](size_t index) { grownAvailability.set(index + shift); });
+        held.forEachSet([&](size_t index) { grownHeld.set(index + shift); });
+        int index = grown->seatIndex(row, seatLetter);
+        if (index >= 0) grownAvailability.set(index);
+        layout = grown;
+        sharedSlot = nullptr;  // sized for the old grid
+        availability = move(grownAvailability);
+        held = move(grownHeld);
+        freeSeats = availability.count();
+    }
+
+    Cents seatPrice(const Seat& seat) const {
+        return __atomic_load_n(&priceTiers[seat.tier()], __ATOMIC_RELAXED);
+    }
+
+    // Slot index of a seat, or -1 if it is not part of this cabin
+    int seatIndex(int row, char letter) const {
+        return layout->seatIndex(row, letter);
+    }
+
+    const Seat* findSeat(int row, char letter) const {
+        int index = seatIndex(row, letter);
+        return index < 0 ? nullptr : &layout->seats[index];
+    }
+
+    bool isSeatAvailable(int row, char letter) const{
+        int index = seatIndex(row, letter);
+        return index >= 0 && availability.test(index);
+    }
+
+    bool bookSeat(int row, char letter) {
+        int index = seatIndex(row, letter);
+        if (index >= 0 && availability.test(index)) {
+            seqLock.writeBegin();
+            availability.clear(index);
+            freeSeats.fetch_sub(1, memory_order_relaxed);
+            mirror(index);
+            seqLock.writeEnd();
+            return true;
+        }
+        return false;
+    }
+
+    void returnSeat(int seatNumber, char seatLetter) {
+        int index = seatIndex(seatNumber, seatLetter);
+        if (index >= 0 && !availability.test(index)) {
+            seqLock.writeBegin();
+            availability.set(index);
+            freeSeats.fetch_add(1, memory_order_relaxed);
+            mirror(index);
+            seqLock.writeEnd();
+        }
+    }
+
+    // Takes a free seat out of sale until the hold is confirmed or released
+    bool holdSeat(int row, char letter) {
+        int index = seatIndex(row, letter);
+        if (index < 0 || !availability.test(index)) return false;
+        seqLock.writeBegin();
+        availability.clear(index);
+        held.set(index);
+        freeSeats.fetch_sub(1, memory_order_relaxed);
+        mirror(index);
+        seqLock.writeEnd();
+        return true;
+    }
+
+    // Turns a held seat into a booked one
+    bool confirmHold(int row, char letter) {
+        int index = seatIndex(row, letter);
+        if (index < 0 || !held.test(index)) return false;
+        seqLock.writeBegin();
+        held.clear(index);
+        seqLock.writeEnd();
+        return true;
+    }
+
+    // Puts a held seat back on sale
+    void releaseHold(int row, char letter) {
+        int index = seatIndex(row, letter);
+        if (index < 0 || !held.test(index)) return;
+        seqLock.writeBegin();
+        held.clear(index);
+        availability.set(index);
+        freeSeats.fetch_add(1, memory_order_relaxed);
+        mirror(index);
+        seqLock.writeEnd();
+    }
+
+    // Marks every seat free again
+    void resetAvailability() {
+        seqLock.writeBegin();
+        layout->configured.forEachSet([&](size_t index) {
+            availability.set(index);
+            held.clear(index);
+        });
+        freeSeats.store(availability.count(), memory_order_relaxed);
+        if (sharedSlot) sharedSlot->publish(availability.words.data(), 0, availability.words.size(), availableSeatCount());
+        seqLock.writeEnd();
+    }
+
+    // Reprices every seat of one tier (one config price range)
+    void setTierPrice(size_t tier, Cents price) {
+        if (tier >= priceTiers.size()) return;
+        seqLock.writeBegin();
+        __atomic_store_n(&priceTiers[tier], price, __ATOMIC_RELAXED);
+        seqLock.writeEnd();
+    }
+
+    // Free seats on the whole aircraft
+    size_t availableSeatCount() const {
+        return freeSeats.load(memory_order_relaxed);
+    }
+
+    // Consistent copy of the availability bitmap without taking the mutex.
+    // Retries while a writer is in the middle of an update. `prices` gets
+    // the tier prices from the same version, so a reprice is never mixed in.
+    SeatBitmap readAvailability(size_t* freeCount = nullptr, vector<Cents>* prices = nullptr) const {
+        SeatBitmap copy(availability.size);
+        if (prices) prices->resize(priceTiers.size());
+        while (true) {
+            uint64_t version = seqLock.readBegin();
+            availability.copyTo(copy);
+            size_t count = freeSeats.load(memory_order_relaxed);
+            if (prices) {
+                for (size_t tier = 0; tier < priceTiers.size(); ++tier) {
+                    (*prices)[tier] = __atomic_load_n(&priceTiers[tier], __ATOMIC_RELAXED);
+                }
+            }
+            if (!seqLock.readRetry(version)) {
+                if (freeCount) *freeCount = count;
+                return copy;
+            }
+        }
+    }
+
+    // Free seats in a single row
+    size_t availableInRow(int row) const {
+        const CabinLayout& cabin = *layout;
+        if (row < cabin.firstRow || row >= cabin.firstRow + cabin.rowCount) return 0;
+        return withRowLayout(cabin.seatsPerRow, [&](auto rowLayout) {
+            return rowLayout.countRow(availability, row - cabin.firstRow);
+        });
+    }
+
+    // Safe to call without the mutex; renders from a seqlock-validated copy
+    void displayAvailableSeats() const {
+        TraceSpan span("render");
+        string out;
+        vector<Cents> prices;
+        readAvailability(nullptr, &prices).forEachSet([&](size_t index) {
+            const Seat& seat = layout->seats[index];
+            ostringstream line;
+            line << "Seat " << seat.number() << seat.letter() << " is available at price $" << formatCents(prices[seat.tier()]) << '\n';
+            out += line.str();
+        });
+        Console() << out;
+    }
+
+private:
+    // Copies the changed availability word to the shared segment. Called
+    // inside a write section, with lock held.
+    void mirror(size_t index) {
+        if (sharedSlot) sharedSlot->publish(availability.words.data(), index >> 6, (index >> 6) + 1, availableSeatCount());
+    }
+};
+
+class File {
+public:
+    // Takes ownership of an already open descriptor (sockets, pipes)
+    explicit File(int fd) : fileDescriptor(fd) {}
+
+    // Constructor opens the file
+    File(const char* filename, int flags) {
+        fileDescriptor = open(filename, flags);
+        if (fileDescriptor == -1) {
+            throw std::runtime_error("Failed to open file");
+        }
+    }
+
+    // Opens the file, creating it with `mode` if O_CREAT is given
+    File(const char* filename, int flags, mode_t mode) {
+        fileDescriptor = open(filename, flags, mode);
+        if (fileDescriptor == -1) {
+            throw std::runtime_error("Failed to open file");
+        }
+    }
+
+    // Destructor closes the file
+    ~File() {
+        if (fileDescriptor != -1) {
+            close(fileDescriptor);
+        }
+    }
+
+    // Disable copy semantics to avoid double-close
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    // Enable move semantics for transferring ownership
+    File(File&& other) noexcept : fileDescriptor(other.fileDescriptor) {
+        other.fileDescriptor = -1; // Nullify the moved-from object's file descriptor
+    }
+
+    File& operator=(File&& other) noexcept {
+        if (this != &other) {
+            if (fileDescriptor != -1) {
+                close(fileDescriptor);
+            }
+            fileDescriptor = other.fileDescriptor;
+            other.fileDescriptor = -1;
+        }
+        return *this;
+    }
+
+    // Reading from the file
+    ssize_t read(void* buffer, size_t size) {
+        return ::read(fileDescriptor, buffer, size);
+    }
+
+    // Writing to the file
+    ssize_t write(const void* buffer, size_t size) {
+        return ::write(fileDescriptor, buffer, size);
+    }
+
+    // File descriptor accessor
+    int getFileDescriptor() const {
+        return fileDescriptor;
+    }
+
+private:
+    int fileDescriptor;
+};
+
+// Length-prefixed binary encoding shared by snapshots and the replication
+// stream. Values are stored in host byte order.
+class BinaryWriter {
+public:
+    string buffer;
+
+    void u8(uint8_t value) { buffer.push_back(char(value)); }
+    void u32(uint32_t value) { raw(&value, sizeof(value)); }
+    void u64(uint64_t value) { raw(&value, sizeof(value)); }
+    void i32(int32_t value) { raw(&value, sizeof(value)); }
+    void i64(int64_t value) { raw(&value, sizeof(value)); }
+    void f64(double value) { raw(&value, sizeof(value)); }
+
+    void str(const string& value) {
+        u32(uint32_t(value.size()));
+        buffer.append(value);
+    }
+
+    // LEB128: seven bits per byte, high bit set on all but the last
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            u8(uint8_t(value) | 0x80);
+            value >>= 7;
+        }
+        u8(uint8_t(value));
+    }
+
+    void raw(const void* data, size_t size) {
+        buffer.append(static_cast<const char*>(data), size);
+    }
+};
+
+class BinaryReader {
+public:
+    explicit BinaryReader(const string& data) : data(data), pos(0) {}
+
+    uint8_t u8() { uint8_t v; raw(&v, sizeof(v)); return v; }
+    uint32_t u32() { uint32_t v; raw(&v, sizeof(v)); return v; }
+    uint64_t u64() { uint64_t v; raw(&v, sizeof(v)); return v; }
+    int32_t i32() { int32_t v; raw(&v, sizeof(v)); return v; }
+    int64_t i64() { int64_t v; raw(&v, sizeof(v)); return v; }
+    double f64() { double v; raw(&v, sizeof(v)); return v; }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = u8();
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        throw std::runtime_error("Malformed varint");
+    }
+
+    string str() {
+        uint32_t size = u32();
+        if (size > data.size() - pos) throw std::runtime_error("Truncated record");
+        string value = data.substr(pos, size);
+        pos += size;
+        return value;
+    }
+
+    void raw(void* out, size_t size) {
+        if (size > data.size() - pos) throw std::runtime_error("Truncated record");
+        memcpy(out, data.data() + pos, size);
+        pos += size;
+    }
+
+    bool atEnd() const { return pos == data.size(); }
+
+private:
+    const string& data;
+    size_t pos;
+};
+
+// Writes the whole buffer, retrying on short writes
+static bool writeFully(File& file, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = file.write(p, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool readFully(File& file, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t got = file.read(p, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+// Background thread that drains every thread's console ring, formats the
+// records and writes the text with large writes. A ring's slots are only
+// released once their text has been written, so destroying the writer
+// (last thing in main) flushes everything queued before it.
+class ConsoleWriter {
+public:
+    static const size_t BatchBytes = 64 * 1024;
+
+    explicit ConsoleWriter(int fd) : output(dup(fd)) {
+        worker = thread([this] { run(); });
+    }
+
+    ~ConsoleWriter() {
+        stopping = true;
+        worker.join();
+    }
+
+    ConsoleWriter(const ConsoleWriter&) = delete;
+    ConsoleWriter& operator=(const ConsoleWriter&) = delete;
+
+    uint64_t busyNanos() const {
+        return busy.load(memory_order_relaxed);
+    }
+
+    // `stats output`
+    void report() const {
+        uint64_t records = 0, stalls = 0;
+        vector<shared_ptr<LogRing>> rings = ConsoleQueues::rings();
+        for (const auto& ring : rings) {
+            records += ring->pushed.load(memory_order_relaxed);
+            stalls += ring->stalls.load(memory_order_relaxed);
+        }
+        Console() << "Console output: " << records << " records from " << rings.size() << " thread(s), "
+                  << stalls << " full-queue stall(s), " << bytesWritten.load() << " bytes in "
+                  << writes.load() << " write(s)\n";
+    }
+
+private:
+    File output;
+    thread worker;
+    atomic<bool> stopping{false};
+    atomic<uint64_t> bytesWritten{0};
+    atomic<uint64_t> writes{0};
+    atomic<uint64_t> busy{0};  // nanoseconds spent formatting and writing
+
+    void run() {
+        vector<shared_ptr<LogRing>> rings;
+        vector<size_t> drainedTo;
+        string buffer;
+        buffer.reserve(BatchBytes * 2);
+        while (true) {
+            bool done = stopping.load();
+            if (rings.size() != ConsoleQueues::ringCount()) rings = ConsoleQueues::rings();
+            drainedTo.resize(rings.size());
+
+            bool drained = false;
+            auto begin = chrono::steady_clock::now();
+            for (size_t i = 0; i < rings.size(); ++i) {
+                LogRing& ring = *rings[i];
+                size_t tail = ring.tail.load(memory_order_relaxed);
+                size_t head = ring.head.load(memory_order_acquire);
+                for (; tail != head; ++tail) {
+                    formatRecord(ring.records[tail & (LogRing::Slots - 1)], buffer);
+                    drained = true;
+                    if (buffer.size() >= BatchBytes) {
+                        drainedTo[i] = tail + 1;
+                        flush(buffer, rings, drainedTo);
+                    }
+                }
+                drainedTo[i] = tail;
+            }
+            flush(buffer, rings, drainedTo);
+            if (drained) {
+                busy += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+            }
+
+            if (!drained) {
+                if (done) break;
+                ConsoleQueues::waitForRecords(rings, chrono::milliseconds(2));
+            }
+        }
+    }
+
+    // Writes the batch, then hands the formatted slots back to producers
+    void flush(string& buffer, const vector<shared_ptr<LogRing>>& rings, const vector<size_t>& drainedTo) {
+        if (!buffer.empty()) {
+            writeFully(output, buffer.data(), buffer.size());
+            bytesWritten += buffer.size();
+            ++writes;
+            buffer.clear();
+        }
+        for (size_t i = 0; i < rings.size(); ++i) {
+            rings[i]->tail.store(drainedTo[i], memory_order_release);
+        }
+    }
+};
+
+// Socket frames: u32 payload length, u8 type, payload
+static bool writeFrame(File& file, uint8_t type, const string& payload) {
+    BinaryWriter header;
+    header.u32(uint32_t(payload.size()));
+    header.u8(type);
+    return writeFully(file, header.buffer.data(), header.buffer.size())
+        && writeFully(file, payload.data(), payload.size());
+}
+
+static bool readFrame(File& file, uint8_t& type, string& payload) {
+    uint32_t size;
+    if (!readFully(file, &size, sizeof(size)) || !readFully(file, &type, sizeof(type))) return false;
+    payload.resize(size);
+    return readFully(file, &payload[0], size);
+}
+
+static int64_t wallClockNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Builds the lookup key for a flight on a given date
+static string flightKey(const string& date, const string& flightNumber) {
+    return date + ' ' + flightNumber;
+}
+
+// Parsed form of one config.txt line
+struct FlightSpec {
+    string date;
+    string flightNumber;
+    int seatsPerRow;
+    vector<PriceRange> ranges;
+
+    string key() const {
+        return flightKey(date, flightNumber);
+    }
+
+    // Same seat grid, prices aside
+    bool sameGeometry(const FlightSpec& other) const {
+        if (seatsPerRow != other.seatsPerRow || ranges.size() != other.ranges.size()) return false;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            if (ranges[i].rowStart != other.ranges[i].rowStart || ranges[i].rowEnd != other.ranges[i].rowEnd) return false;
+        }
+        return true;
+    }
+
+    bool samePrices(const FlightSpec& other) const {
+        for (size_t i = 0; i < ranges.size() && i < other.ranges.size(); ++i) {
+            if (ranges[i].price != other.ranges[i].price) return false;
+        }
+        return true;
+    }
+};
+
+// Days since 1970-01-01 for a dd.mm.yyyy date (Hinnant's days_from_civil).
+// Only the exact form is accepted: flights are keyed by the date string,
+// so "1.1.2025" or "01.01.2025x" must not pass as 01.01.2025.
+static bool parseDate(const string& date, int64_t& day) {
+    if (date.size() != 10 || date[2] != '.' || date[5] != '.') return false;
+    for (size_t i : {0, 1, 3, 4, 6, 7, 8, 9}) {
+        if (date[i] < '0' || date[i] > '9') return false;
+    }
+    int d = (date[0] - '0') * 10 + (date[1] - '0');
+    int m = (date[3] - '0') * 10 + (date[4] - '0');
+    int y = stoi(date.substr(6));
+    if (m < 1 || m > 12 || d < 1) return false;
+    static const int monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (d > monthDays[m - 1] + (m == 2 && leap)) return false;
+    int64_t year = y - (m <= 2);
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t yearOfEra = year - era * 400;
+    int64_t dayOfYear = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    day = era * 146097 + dayOfEra - 719468;
+    return true;
+}
+
+// A recurring flight from a rule line such as
+//   FQ12 daily from 01.01.2025 to 31.12.2025 6 1-20 100$ 21-40 50$
+// One template stands for every date it covers; Program builds the
+// Airplane for a date only when that date is first used.
+struct ScheduleRule {
+    string flightNumber;
+    int64_t firstDay;
+    int64_t lastDay;
+    int stepDays;      // 1 for daily, 7 for weekly
+    FlightSpec shape;  // seat grid and prices; date left empty
+    shared_ptr<const Airplane> blank;  // every seat free; answers reads of dates not built yet
+
+    bool covers(const string& date) const {
+        int64_t day;
+        return parseDate(date, day) && day >= firstDay && day <= lastDay && (day - firstDay) % stepDays == 0;
+    }
+
+    size_t dateCount() const {
+        return lastDay < firstDay ? 0 : size_t((lastDay - firstDay) / stepDays + 1);
+    }
+
+    FlightSpec on(const string& date) const {
+        FlightSpec spec = shape;
+        spec.date = date;
+        return spec;
+    }
+};
+
+// Everything a config file describes: dated flights and recurring rules
+struct FlightSchedule {
+    vector<FlightSpec> flights;
+    vector<ScheduleRule> rules;
+};
+
+class ConfigReader {
+public:
+    // Dated flights only; schedule rules are skipped
+    vector<FlightSpec> parseConfig(const string& configFile) {
+        return parseSchedule(configFile).flights;
+    }
+
+    FlightSchedule parseSchedule(const string& configFile) {
+        AIRFLIGHT_PROBE(config__load__start, configFile.c_str());
+        FlightSchedule schedule;
+        File file(configFile.c_str(), O_RDONLY);
+        char buffer[4096];
+        ssize_t bytesRead;
+        string fileContent;
+
+        while ((bytesRead = file.read(buffer, sizeof(buffer))) > 0) {
+            fileContent.append(buffer, bytesRead);
+        }
+
+        // Handle case where file couldn't be read
+        if (bytesRead == -1) {
+            throw std::runtime_error("Error reading file");
+        }
+        istringstream ss(fileContent);
+        string line;
+        while (getline(ss, line)) {
+            stringstream lineStream(line);
+            string first, second;
+            if (!(lineStream >> first >> second)) continue;
+            if (second == "daily" || second == "weekly") {
+                ScheduleRule rule;
+                if (parseRule(lineStream, first, second == "daily" ? 1 : 7, rule)) schedule.rules.push_back(rule);
+                continue;
+            }
+
+            FlightSpec spec;
+            spec.date = first;
+            spec.flightNumber = second;
+            if (!(lineStream >> spec.seatsPerRow)) continue;
+            readRanges(lineStream, spec);
+            schedule.flights.push_back(spec);
+        }
+
+        AIRFLIGHT_PROBE(config__load__done, configFile.c_str(), schedule.flights.size() + schedule.rules.size());
+        return schedule;
+    }
+
+    static shared_ptr<Airplane> buildAirplane(const FlightSpec& spec) {
+        return allocate_shared<Airplane>(CountingAllocator<Airplane, MemoryTag::Airplanes>(),
+                                         spec.flightNumber, spec.date, spec.seatsPerRow, spec.ranges);
+    }
+
+    vector<shared_ptr<Airplane>> loadConfig(const string& configFile) {
+        vector<shared_ptr<Airplane>> airplanes;
+        for (const auto& spec : parseConfig(configFile)) {
+            airplanes.push_back(buildAirplane(spec));
+        }
+        return airplanes;
+    }
+
+private:
+    // Row ranges with prices: "1-20 100$ 21-40 50$". Seats store rows as
+    // 16 bits, so rows outside 0-65535 are a config error.
+    static void readRanges(istream& lineStream, FlightSpec& spec) {
+        int rowStart, rowEnd;
+        string priceStr;
+
+        while (lineStream >> rowStart ) {
+            char dash;
+            if (!(lineStream >> dash >> rowEnd >> priceStr)) {
+                throw std::runtime_error("Incomplete row range for flight " + spec.flightNumber);
+            }
+            if (rowStart < 0 || rowEnd < 0 || rowStart > Seat::MaxRow || rowEnd > Seat::MaxRow) {
+                throw std::runtime_error("Row range " + to_string(rowStart) + "-" + to_string(rowEnd) + " for flight " +
+                                         spec.flightNumber + " is outside 0-" + to_string(Seat::MaxRow));
+            }
+
+            spec.ranges.push_back({rowStart, rowEnd, parseCents(priceStr)});
+        }
+    }
+
+    // The rest of "<flight> daily|weekly from <date> to <date> <seatsPerRow> <ranges>"
+    static bool parseRule(istream& lineStream, const string& flightNumber, int stepDays, ScheduleRule& rule) {
+        string from, firstDate, to, lastDate;
+        if (!(lineStream >> from >> firstDate >> to >> lastDate) || from != "from" || to != "to") return false;
+        if (!parseDate(firstDate, rule.firstDay) || !parseDate(lastDate, rule.lastDay)) return false;
+        rule.flightNumber = flightNumber;
+        rule.stepDays = stepDays;
+        rule.shape.flightNumber = flightNumber;
+        if (!(lineStream >> rule.shape.seatsPerRow)) return false;
+        readRanges(lineStream, rule.shape);
+        rule.blank = buildAirplane(rule.shape);
+        return true;
+    }
+};
+
+// A loaded flight together with the config line it came from
+struct FlightEntry {
+    FlightSpec spec;
+    shared_ptr<Airplane> airplane;
+    bool scheduled = false;  // instantiated from a schedule rule
+};
+
+// Immutable flight index. Program publishes a new table on every reload
+// (and when a scheduled date is first used) and readers keep whichever
+// version they loaded alive through the shared_ptr.
+struct FlightTable {
+    map<string, FlightEntry, less<string>,
+        CountingAllocator<pair<const string, FlightEntry>, MemoryTag::Indexes>> flights;
+    vector<ScheduleRule> rules;
+
+    shared_ptr<Airplane> find(const string& flightNumber, const string& date) const {
+        auto it = flights.find(flightKey(date, flightNumber));
+        return it == flights.end() ? nullptr : it->second.airplane;
+    }
+
+    // Rule covering a date that has no Airplane yet; dated config lines
+    // take precedence over rules
+    const ScheduleRule* ruleFor(const string& flightNumber, const string& date) const {
+        for (const auto& rule : rules) {
+            if (rule.flightNumber == flightNumber && rule.covers(date)) return &rule;
+        }
+        return nullptr;
+    }
+};
+
+// POSIX shared-memory copy of every flight's seat availability, for local
+// readers that only need availability (`--shm-availability <name>`). The
+// segment starts with a header and a fixed index of flight keys; each
+// index entry points at an AvailabilitySlot that the flight's Airplane
+// updates inside its own write section. A rebuilt or removed flight
+// retires its entry; when the key comes back the entry and its slot are
+// reused if the new grid fits, otherwise a new entry is appended. The
+// grid geometry can therefore change under a reader, so it is written
+// inside the slot's seqLock like the bitmap.
+class AvailabilitySegment {
+public:
+    static constexpr char Magic[] = "AFAVAIL1";
+    static const uint32_t Version = 2;
+    static const size_t KeyBytes = 48;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t capacity;              // index entries
+        atomic<uint32_t> entryCount;    // published entries, append-only
+        int32_t owner;                  // pid of the writing process
+        uint64_t dataOffset;            // where slots start
+        uint64_t totalBytes;
+    };
+
+    enum EntryState : uint32_t { Live = 1, Retired = 2 };
+
+    struct Geometry {
+        int32_t seatsPerRow;
+        int32_t firstRow;
+        int32_t rowCount;
+        uint32_t rowStride;
+    };
+
+    struct IndexEntry {
+        char key[KeyBytes];             // flightKey, NUL-terminated; fixed once published
+        uint64_t slotOffset;            // from the start of the segment
+        Geometry geometry;              // read under the slot's seqLock
+        atomic<uint32_t> state;
+        uint32_t pad;
+    };
+
+    AvailabilitySegment(const string& name, uint32_t capacity = 16384, size_t dataBytes = size_t(64) << 20)
+        : name(name) {
+        size_t indexBytes = sizeof(Header) + size_t(capacity) * sizeof(IndexEntry);
+        size_t dataOffset = (indexBytes + 63) & ~size_t(63);
+        size = dataOffset + dataBytes;
+        refuseLiveOwner(name);
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd == -1) throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+        File segment(fd);
+        // The segment is sparse; only pages that slots touch get memory
+        if (ftruncate(fd, off_t(size)) != 0) throw std::runtime_error("ftruncate " + name + ": " + strerror(errno));
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+        base = static_cast<char*>(mapping);
+        header = new (base) Header{};
+        header->version = Version;
+        header->capacity = capacity;
+        header->dataOffset = dataOffset;
+        header->totalBytes = size;
+        header->owner = int32_t(getpid());
+        dataUsed = dataOffset;
+        memcpy(header->magic, Magic, sizeof(header->magic));  // last, so readers never see a half-built header
+    }
+
+    ~AvailabilitySegment() {
+        munmap(base, size);
+        shm_unlink(name.c_str());
+    }
+
+    AvailabilitySegment(const AvailabilitySegment&) = delete;
+    AvailabilitySegment& operator=(const AvailabilitySegment&) = delete;
+
+    // Gives every flight in `table` a live entry and retires entries of
+    // flights that left it. Callers serialize table publication.
+    void publish(const FlightTable& table) {
+        lock_guard<mutex> guard(publishMutex);
+        skipped = 0;
+        for (const auto& entry : table.flights) {
+            auto published = entries.find(entry.first);
+            if (published != entries.end() && published->second.slot == entry.second.airplane->sharedSlot) continue;
+            if (published != entries.end()) retire(published);
+            attach(entry.first, entry.second.airplane);
+        }
+        for (auto it = entries.begin(); it != entries.end(); ) {
+            auto current = it++;
+            if (!table.flights.count(current->first)) retire(current);
+        }
+        if (skipped) {
+            Console() << "Shared availability " << name << " is full: " << skipped
+                      << " flights are missing from it; restart with a larger segment.\n";
+        }
+    }
+
+    void report() {
+        lock_guard<mutex> guard(publishMutex);
+        Console() << "Shared availability " << name << ": " << entries.size() << " flights live, "
+                  << header->entryCount.load(memory_order_relaxed) << "/" << header->capacity << " index entries ("
+                  << retired.size() << " retired), "
+                  << (dataUsed - header->dataOffset) << "/" << (size - header->dataOffset) << " data bytes";
+        if (skipped) Console() << ", " << skipped << " flights did not fit";
+        Console() << "\n";
+    }
+
+private:
+    struct Published {
+        AvailabilitySlot* slot;
+        uint32_t entry;
+        size_t capacityWords;      // bitmap words the slot has room for
+        weak_ptr<Airplane> airplane;
+    };
+
+    string name;
+    size_t size = 0;
+    char* base = nullptr;
+    Header* header = nullptr;
+    mutex publishMutex;        // guards entries, retired, dataUsed and skipped
+    map<string, Published> entries;  // live entries by flight key
+    map<string, Published> retired;  // the reusable retired entry of each key
+    size_t dataUsed = 0;
+    size_t skipped = 0;        // flights left out of the last publish for lack of room
+
+    // Segments are recreated on start; one whose writer is still running
+    // belongs to another process and must not be unlinked under it
+    static void refuseLiveOwner(const string& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1) return;
+        File segment(fd);
+        alignas(Header) char raw[sizeof(Header)];
+        if (pread(fd, raw, sizeof(raw), 0) != ssize_t(sizeof(raw))) return;
+        const Header* existing = reinterpret_cast<const Header*>(raw);
+        if (memcmp(existing->magic, Magic, sizeof(existing->magic)) == 0 && existing->version == Version &&
+            existing->owner > 0 && existing->owner != getpid() && kill(pid_t(existing->owner), 0) == 0) {
+            throw std::runtime_error(name + " is in use by running process " + to_string(existing->owner));
+        }
+    }
+
+    IndexEntry& indexEntry(uint32_t index) {
+        return reinterpret_cast<IndexEntry*>(base + sizeof(Header))[index];
+    }
+
+    // The old Airplane may still be alive in a table someone holds; it must
+    // stop writing into a slot that is about to be reused
+    void retire(map<string, Published>::iterator it) {
+        indexEntry(it->second.entry).state.store(Retired, memory_order_release);
+        if (shared_ptr<Airplane> airplane = it->second.airplane.lock()) {
+            lock_guard<ContendedMutex> seatGuard(airplane->lock);
+            if (airplane->sharedSlot == it->second.slot) airplane->sharedSlot = nullptr;
+        }
+        auto kept = retired.find(it->first);
+        if (kept == retired.end() || kept->second.capacityWords < it->second.capacityWords) {
+            retired[it->first] = it->second;
+        }
+        entries.erase(it);
+    }
+
+    void attach(const string& key, const shared_ptr<Airplane>& airplane) {
+        lock_guard<ContendedMutex> seatGuard(airplane->lock);
+        const CabinLayout& cabin = *airplane->layout;
+        size_t words = airplane->availability.words.size();
+        Published published;
+        auto reusable = retired.find(key);
+        if (reusable != retired.end() && reusable->second.capacityWords >= words) {
+            published = reusable->second;
+            retired.erase(reusable);
+        } else {
+            size_t slotBytes = (sizeof(AvailabilitySlot) + words * sizeof(uint64_t) + 63) & ~size_t(63);
+            uint32_t index = header->entryCount.load(memory_order_relaxed);
+            if (index >= header->capacity || dataUsed + slotBytes > size || key.size() >= KeyBytes) {
+                ++skipped;
+                return;
+            }
+            published.slot = new (base + dataUsed) AvailabilitySlot;
+            published.entry = index;
+            published.capacityWords = words;
+            IndexEntry& entry = indexEntry(index);
+            memcpy(entry.key, key.c_str(), key.size() + 1);
+            entry.slotOffset = dataUsed;
+            dataUsed += slotBytes;
+        }
+
+        // Geometry, size and bitmap change together for readers
+        IndexEntry& entry = indexEntry(published.entry);
+        AvailabilitySlot* slot = published.slot;
+        slot->seqLock.writeBegin();
+        __atomic_store_n(&entry.geometry.seatsPerRow, cabin.seatsPerRow, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry.geometry.firstRow, cabin.firstRow, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry.geometry.rowCount, cabin.rowCount, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry.geometry.rowStride, uint32_t(cabin.rowStride), __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->wordCount, uint64_t(words), __ATOMIC_RELAXED);
+        slot->store(airplane->availability.words.data(), 0, words, airplane->availableSeatCount());
+        slot->seqLock.writeEnd();
+        entry.state.store(Live, memory_order_release);
+        if (published.entry == header->entryCount.load(memory_order_relaxed)) {
+            header->entryCount.store(published.entry + 1, memory_order_release);
+        }
+        airplane->sharedSlot = slot;
+        published.airplane = airplane;
+        entries[key] = published;
+    }
+};
+
+// Read-only view of an AvailabilitySegment from another process
+class AvailabilityReader {
+public:
+    explicit AvailabilityReader(const string& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1) throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+        File segment(fd);
+        struct stat info;
+        if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(AvailabilitySegment::Header)) {
+            throw std::runtime_error(name + " is not an availability segment");
+        }
+        size = size_t(info.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+        base = static_cast<const char*>(mapping);
+        header = reinterpret_cast<const AvailabilitySegment::Header*>(base);
+        if (memcmp(header->magic, AvailabilitySegment::Magic, sizeof(header->magic)) != 0 ||
+            header->version != AvailabilitySegment::Version || header->totalBytes != size) {
+            munmap(const_cast<char*>(base), size);
+            throw std::runtime_error(name + " is not an availability segment");
+        }
+    }
+
+    ~AvailabilityReader() {
+        munmap(const_cast<char*>(base), size);
+    }
+
+    AvailabilityReader(const AvailabilityReader&) = delete;
+    AvailabilityReader& operator=(const AvailabilityReader&) = delete;
+
+    // Live entries, in publication order
+    vector<const AvailabilitySegment::IndexEntry*> flights() const {
+        vector<const AvailabilitySegment::IndexEntry*> live;
+        uint32_t count = min(header->entryCount.load(memory_order_acquire), header->capacity);
+        for (uint32_t i = 0; i < count; ++i) {
+            const auto& entry = indexEntry(i);
+            if (entry.state.load(memory_order_acquire) == AvailabilitySegment::Live) live.push_back(&entry);
+        }
+        return live;
+    }
+
+    // Latest live entry for a flight, or nullptr
+    const AvailabilitySegment::IndexEntry* find(const string& date, const string& flightNumber) const {
+        string key = flightKey(date, flightNumber);
+        const AvailabilitySegment::IndexEntry* found = nullptr;
+        for (const auto* entry : flights()) {
+            if (key == entry->key) found = entry;
+        }
+        return found;
+    }
+
+    // Consistent copy of a flight's bitmap, free count and grid geometry;
+    // a reused entry can change all three
+    SeatBitmap read(const AvailabilitySegment::IndexEntry& entry, size_t* freeCount = nullptr,
+                    AvailabilitySegment::Geometry* geometry = nullptr) const {
+        const auto* slot = reinterpret_cast<const AvailabilitySlot*>(base + entry.slotOffset);
+        while (true) {
+            uint64_t version = slot->seqLock.readBegin();
+            AvailabilitySegment::Geometry shape{__atomic_load_n(&entry.geometry.seatsPerRow, __ATOMIC_RELAXED),
+                                                __atomic_load_n(&entry.geometry.firstRow, __ATOMIC_RELAXED),
+                                                __atomic_load_n(&entry.geometry.rowCount, __ATOMIC_RELAXED),
+                                                __atomic_load_n(&entry.geometry.rowStride, __ATOMIC_RELAXED)};
+            SeatBitmap copy(size_t(max(shape.rowCount, 0)) * shape.rowStride);
+            size_t words = min<size_t>(copy.words.size(), __atomic_load_n(&slot->wordCount, __ATOMIC_RELAXED));
+            for (size_t w = 0; w < words; ++w) copy.words[w] = __atomic_load_n(&slot->words()[w], __ATOMIC_RELAXED);
+            size_t count = slot->freeSeats.load(memory_order_relaxed);
+            if (!slot->seqLock.readRetry(version)) {
+                if (freeCount) *freeCount = count;
+                if (geometry) *geometry = shape;
+                return copy;
+            }
+        }
+    }
+
+    // Row and letter of a bitmap slot
+    static void seatAt(const AvailabilitySegment::Geometry& geometry, size_t index, int& row, char& letter) {
+        row = geometry.firstRow + int(index / geometry.rowStride);
+        letter = char('A' + index % geometry.rowStride);
+    }
+
+private:
+    size_t size = 0;
+    const char* base = nullptr;
+    const AvailabilitySegment::Header* header = nullptr;
+
+    const AvailabilitySegment::IndexEntry& indexEntry(uint32_t index) const {
+        return reinterpret_cast<const AvailabilitySegment::IndexEntry*>(base + sizeof(AvailabilitySegment::Header))[index];
+    }
+};
+
+// Watches the config file and calls onChange after it has been rewritten.
+// Uses inotify on the containing directory so editors that replace the file
+// by rename are picked up too; other platforms poll the modification time.
+class ConfigWatcher {
+public:
+    ConfigWatcher(const string& path, function<void()> onChange)
+        : configPath(path), callback(move(onChange)), stopping(false) {
+        worker = thread([this] { run(); });
+    }
+
+    ~ConfigWatcher() {
+        stopping = true;
+        worker.join();
+    }
+
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+private:
+    string configPath;
+    function<void()> callback;
+    atomic<bool> stopping;
+    thread worker;
+
+    void run() {
+        size_t slash = configPath.find_last_of('/');
+        string dir = slash == string::npos ? "." : configPath.substr(0, slash);
+        string name = slash == string::npos ? configPath : configPath.substr(slash + 1);
+#ifdef __linux__
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd != -1 && inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) != -1) {
+            alignas(inotify_event) char buffer[4096];
+            while (!stopping) {
+                pollfd pfd = {fd, POLLIN, 0};
+                if (poll(&pfd, 1, 200) <= 0) continue;
+                bool changed = false;
+                ssize_t length;
+                while ((length = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                    for (char* p = buffer; p < buffer + length; ) {
+                        auto* event = reinterpret_cast<inotify_event*>(p);
+                        if (event->len > 0 && name == event->name) changed = true;
+                        p += sizeof(inotify_event) + event->len;
+                    }
+                }
+                if (changed) callback();
+            }
+            close(fd);
+            return;
+        }
+        if (fd != -1) close(fd);
+#endif
+        struct stat info;
+        timespec lastModified = {0, 0};
+        if (stat(configPath.c_str(), &info) == 0) lastModified = modificationTime(info);
+        while (!stopping) {
+            this_thread::sleep_for(chrono::milliseconds(500));
+            if (stat(configPath.c_str(), &info) != 0) continue;
+            timespec modified = modificationTime(info);
+            if (modified.tv_sec != lastModified.tv_sec || modified.tv_nsec != lastModified.tv_nsec) {
+                lastModified = modified;
+                callback();
+            }
+        }
+    }
+
+    static timespec modificationTime(const struct stat& info) {
+#ifdef __APPLE__
+        return info.st_mtimespec;
+#else
+        return info.st_mtim;
+#endif
+    }
+};
+
+// Hierarchical timing wheel (Varghese & Lauck). Four levels of 256 slots
+// cover 2^32 ticks; a timer sits in the coarsest level that still
+// distinguishes its expiry and cascades down as time approaches it, so
+// scheduling, cancelling and expiring are O(1) amortized. Timer nodes live
+// in a slab with intrusive links, so there is no per-timer allocation.
+class TimingWheel {
+public:
+    typedef uint32_t TimerId;
+
+    explicit TimingWheel(uint64_t startTick = 0) : now(startTick), active(0) {
+        fill(begin(heads), end(heads), None);
+    }
+
+    TimerId schedule(uint64_t expiryTick, uint64_t payload) {
+        TimerId id;
+        if (!freeList.empty()) {
+            id = freeList.back();
+            freeList.pop_back();
+        } else {
+            id = TimerId(nodes.size());
+            nodes.push_back(Node());
+        }
+        nodes[id].expiry = max(expiryTick, now + 1);
+        nodes[id].payload = payload;
+        place(id);
+        ++active;
+        return id;
+    }
+
+    void cancel(TimerId id) {
+        if (id >= nodes.size() || nodes[id].slot == None) return;
+        unlink(id);
+        release(id);
+    }
+
+    // Moves the wheel forward to `tick`, calling expire(payload) for every
+    // timer that came due
+    template <typename Fn>
+    void advance(uint64_t tick, Fn expire) {
+        while (now < tick) {
+            ++now;
+            // Cascade coarser levels whenever a finer one wraps around
+            for (int level = 1; level < Levels; ++level) {
+                if ((now & ((uint64_t(1) << (LevelBits * level)) - 1)) != 0) break;
+                cascade(level * Slots + ((now >> (LevelBits * level)) & SlotMask));
+            }
+            uint32_t slot = now & SlotMask;
+            uint32_t id = heads[slot];
+            heads[slot] = None;
+            while (id != None) {
+                uint32_t next = nodes[id].next;
+                nodes[id].slot = None;
+                uint64_t payload = nodes[id].payload;
+                release(id);
+                expire(payload);
+                id = next;
+            }
+        }
+    }
+
+    uint64_t currentTick() const { return now; }
+    size_t size() const { return active; }
+
+private:
+    static constexpr int LevelBits = 8;
+    static constexpr int Levels = 4;
+    static constexpr uint32_t Slots = 1u << LevelBits;
+    static constexpr uint32_t SlotMask = Slots - 1;
+    static constexpr uint32_t None = 0xffffffffu;
+
+    struct Node {
+        uint64_t expiry = 0;
+        uint64_t payload = 0;
+        uint32_t prev = None;
+        uint32_t next = None;
+        uint32_t slot = None;
+    };
+
+    vector<Node> nodes;
+    vector<uint32_t> freeList;
+    uint32_t heads[Levels * Slots];
+    uint64_t now;
+    size_t active;
+
+    void place(uint32_t id) {
+        Node& node = nodes[id];
+        uint64_t delta = node.expiry - now;
+        int level = 0;
+        while (level < Levels - 1 && delta >= (uint64_t(1) << (LevelBits * (level + 1)))) ++level;
+        uint64_t expiry = min(node.expiry, now + (uint64_t(1) << (LevelBits * Levels)) - 1);
+        node.slot = level * Slots + ((expiry >> (LevelBits * level)) & SlotMask);
+        node.prev = None;
+        node.next = heads[node.slot];
+        if (node.next != None) nodes[node.next].prev = id;
+        heads[node.slot] = id;
+    }
+
+    void unlink(uint32_t id) {
+        Node& node = nodes[id];
+        if (node.prev != None) {
+            nodes[node.prev].next = node.next;
+        } else {
+            heads[node.slot] = node.next;
+        }
+        if (node.next != None) nodes[node.next].prev = node.prev;
+        node.slot = None;
+    }
+
+    void release(uint32_t id) {
+        nodes[id].slot = None;
+        freeList.push_back(id);
+        --active;
+    }
+
+    void cascade(uint32_t slot) {
+        uint32_t id = heads[slot];
+        heads[slot] = None;
+        while (id != None) {
+            uint32_t next = nodes[id].next;
+            place(id);
+            id = next;
+        }
+    }
+};
+
+// A booking-state change, as streamed from the primary to its followers
+struct Mutation {
+    enum Type : uint8_t { Book = 1, Return = 2, Deposit = 3 };
+
+    uint8_t type;
+    int ticketID;
+    string flightNumber;
+    string date;
+    int row;
+    char letter;
+    string passengerName;
+    int64_t amount = 0;  // cents, for deposits
+
+    void encode(BinaryWriter& out) const {
+        out.u8(type);
+        out.i32(ticketID);
+        out.str(flightNumber);
+        out.str(date);
+        out.i32(row);
+        out.u8(uint8_t(letter));
+        out.str(passengerName);
+        out.i64(amount);
+    }
+
+    static Mutation decode(BinaryReader& in) {
+        Mutation m;
+        m.type = in.u8();
+        m.ticketID = in.i32();
+        m.flightNumber = in.str();
+        m.date = in.str();
+        m.row = in.i32();
+        m.letter = char(in.u8());
+        m.passengerName = in.str();
+        m.amount = in.i64();
+        return m;
+    }
+};
+
+// In-memory log of encoded mutations with monotonically increasing offsets.
+// Offset N is the N-th mutation ever appended (starting at 1); only the most
+// recent `capacity` entries are retained, older readers need a snapshot.
+class ReplicationLog {
+public:
+    explicit ReplicationLog(size_t capacity = 1 << 20) : capacity(capacity), firstOffset(1), nextOffset(1) {}
+
+    uint64_t append(const Mutation& mutation) {
+        BinaryWriter out;
+        out.i64(wallClockNanos());
+        mutation.encode(out);
+        lock_guard<mutex> guard(lock);
+        entries.push_back(move(out.buffer));
+        if (entries.size() > capacity) {
+            entries.pop_front();
+            ++firstOffset;
+        }
+        uint64_t offset = nextOffset++;
+        changed.notify_all();
+        return offset;
+    }
+
+    // Offset of the most recent mutation (0 if none)
+    uint64_t head() const {
+        lock_guard<mutex> guard(lock);
+        return nextOffset - 1;
+    }
+
+    // Copies entries after `offset` into `out`, waiting up to `timeout` for
+    // new ones. Returns false if `offset` has already been trimmed.
+    bool readAfter(uint64_t offset, vector<string>& out, chrono::milliseconds timeout) {
+        unique_lock<mutex> guard(lock);
+        if (offset + 1 < firstOffset) return false;
+        changed.wait_for(guard, timeout, [&] { return nextOffset - 1 > offset; });
+        for (uint64_t o = offset + 1; o < nextOffset; ++o) {
+            out.push_back(entries[o - firstOffset]);
+        }
+        return true;
+    }
+
+private:
+    size_t capacity;
+    mutable mutex lock;
+    condition_variable changed;
+    deque<string> entries;
+    uint64_t firstOffset;
+    uint64_t nextOffset;
+};
+
+// Flights and balances as written by incremental checkpoints. A delta
+// holds only what changed since the previous checkpoint; merging deltas in
+// order over the base gives the current state.
+struct CheckpointImage {
+    struct TicketState {
+        int ticketID;
+        int row;
+        char letter;
+        string passengerName;
+        Cents price;
+    };
+    struct FlightState {
+        string date;
+        string flightNumber;
+        vector<TicketState> tickets;  // every ticket on the flight, replacing older images
+    };
+
+    uint64_t sequence = 0;
+    int lastTicketID = 0;              // highest ticket ID ever issued, so restarts never reuse one
+    map<string, FlightState> flights;  // by flightKey
+    map<string, Cents> balances;       // by passenger name
+
+    // Newer flight and balance records replace older ones
+    void merge(CheckpointImage&& newer) {
+        for (auto& flight : newer.flights) flights[flight.first] = move(flight.second);
+        for (const auto& balance : newer.balances) balances[balance.first] = balance.second;
+        sequence = newer.sequence;
+        lastTicketID = max(lastTicketID, newer.lastTicketID);
+    }
+
+    string encode(const char* magic) const {
+        BinaryWriter out;
+        out.raw(magic, 8);
+        out.u64(sequence);
+        out.i32(lastTicketID);
+        out.u32(uint32_t(flights.size()));
+        for (const auto& entry : flights) {
+            out.str(entry.second.date);
+            out.str(entry.second.flightNumber);
+            out.u32(uint32_t(entry.second.tickets.size()));
+            for (const auto& ticket : entry.second.tickets) {
+                out.i32(ticket.ticketID);
+                out.i32(ticket.row);
+                out.u8(uint8_t(ticket.letter));
+                out.str(ticket.passengerName);
+                out.i64(ticket.price);
+            }
+        }
+        out.u32(uint32_t(balances.size()));
+        for (const auto& balance : balances) {
+            out.str(balance.first);
+            out.i64(balance.second);
+        }
+        return out.buffer;
+    }
+
+    static CheckpointImage decode(const string& data, const char* magic) {
+        if (data.compare(0, 8, magic, 8) != 0) throw std::runtime_error("Not a checkpoint file");
+        BinaryReader in(data);
+        string header(8, '\0');
+        in.raw(&header[0], header.size());
+        CheckpointImage image;
+        image.sequence = in.u64();
+        image.lastTicketID = in.i32();
+        for (uint32_t count = in.u32(); count > 0; --count) {
+            FlightState flight;
+            flight.date = in.str();
+            flight.flightNumber = in.str();
+            flight.tickets.resize(in.u32());
+            for (auto& ticket : flight.tickets) {
+                ticket.ticketID = in.i32();
+                ticket.row = in.i32();
+                ticket.letter = char(in.u8());
+                ticket.passengerName = in.str();
+                ticket.price = in.i64();
+            }
+            image.flights[flightKey(flight.date, flight.flightNumber)] = move(flight);
+        }
+        for (uint32_t count = in.u32(); count > 0; --count) {
+            string name = in.str();
+            image.balances[name] = in.i64();
+        }
+        return image;
+    }
+};
+
+// Checkpoint files in one directory: base.ckpt plus delta-<sequence>.ckpt
+// files newer than it. Files are written to a temporary name, synced and
+// renamed, so a crash leaves either the old or the new file.
+class CheckpointStore {
+public:
+    static constexpr char BaseMagic[] = "AFBASE02";
+    static constexpr char DeltaMagic[] = "AFDELTA2";
+
+    explicit CheckpointStore(const string& directory) : directory(directory) {
+        mkdir(directory.c_str(), 0755);
+    }
+
+    const string& path() const { return directory; }
+
+    // Sequence numbers of the deltas on disk, oldest first
+    vector<uint64_t> deltas() const {
+        vector<uint64_t> sequences;
+        if (DIR* dir = opendir(directory.c_str())) {
+            while (dirent* entry = readdir(dir)) {
+                unsigned long long sequence;
+                char tail[8];
+                if (sscanf(entry->d_name, "delta-%llu.%7s", &sequence, tail) == 2 && string(tail) == "ckpt") {
+                    sequences.push_back(sequence);
+                }
+            }
+            closedir(dir);
+        }
+        sort(sequences.begin(), sequences.end());
+        return sequences;
+    }
+
+    bool hasBase() const {
+        struct stat info;
+        return stat(basePath().c_str(), &info) == 0;
+    }
+
+    // Base merged with every newer delta
+    CheckpointImage load() const {
+        CheckpointImage image;
+        if (hasBase()) image = CheckpointImage::decode(readFile(basePath()), BaseMagic);
+        for (uint64_t sequence : deltas()) {
+            if (sequence <= image.sequence) continue;
+            image.merge(CheckpointImage::decode(readFile(deltaPath(sequence)), DeltaMagic));
+        }
+        return image;
+    }
+
+    // Returns the bytes written
+    size_t writeDelta(const CheckpointImage& image) const {
+        return writeAtomically(deltaPath(image.sequence), image.encode(DeltaMagic));
+    }
+
+    size_t writeBase(const CheckpointImage& image) const {
+        return writeAtomically(basePath(), image.encode(BaseMagic));
+    }
+
+    // Folds the deltas into a new base and removes them; returns the base size
+    size_t mergeDeltas() const {
+        CheckpointImage image = load();
+        size_t bytes = writeBase(image);
+        dropDeltas(image.sequence);
+        return bytes;
+    }
+
+    // Removes deltas already contained in the base
+    void dropDeltas(uint64_t throughSequence) const {
+        for (uint64_t sequence : deltas()) {
+            if (sequence <= throughSequence) unlink(deltaPath(sequence).c_str());
+        }
+    }
+
+private:
+    string directory;
+
+    string basePath() const {
+        return directory + "/base.ckpt";
+    }
+
+    string deltaPath(uint64_t sequence) const {
+        char name[40];
+        snprintf(name, sizeof(name), "/delta-%012llu.ckpt", (unsigned long long)sequence);
+        return directory + name;
+    }
+
+    static string readFile(const string& path) {
+        File file(path.c_str(), O_RDONLY);
+        string data;
+        char chunk[65536];
+        ssize_t bytesRead;
+        while ((bytesRead = file.read(chunk, sizeof(chunk))) > 0) data.append(chunk, bytesRead);
+        if (bytesRead < 0) throw std::runtime_error("Error reading " + path);
+        return data;
+    }
+
+    static size_t writeAtomically(const string& path, const string& data) {
+        string temporary = path + ".tmp";
+        {
+            File file(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (!writeFully(file, data.data(), data.size()) || fsync(file.getFileDescriptor()) != 0) {
+                throw std::runtime_error("Error writing " + temporary);
+            }
+        }
+        if (rename(temporary.c_str(), path.c_str()) != 0) throw std::runtime_error("Error renaming " + temporary);
+        return data.size();
+    }
+};
+
+// Passengers, balances and current tickets kept in a named shared-memory
+// object (/dev/shm on Linux) that outlives the process, so a restarted
+// binary can reattach instead of loading a snapshot (`--state-arena`).
+// Records link to each other by offsets from the start of the mapping,
+// which stay valid wherever a later process maps it. Program writes
+// through to the arena under ledgerMutex; `generation` is odd while a
+// ledger critical section is writing, so a process killed mid-update
+// leaves an arena that fails validation and recovery falls back to
+// checkpoints or a snapshot.
+class StateArena {
+public:
+    static constexpr char Magic[] = "AFSTATE1";
+    static const uint32_t Version = 2;
+
+    // Offset of a T from the start of the arena; 0 is null
+    template <typename T>
+    struct ArenaPtr {
+        uint64_t offset = 0;
+        explicit operator bool() const { return offset != 0; }
+    };
+
+    struct TicketRecord;
+    struct FlightRecord;
+
+    struct PassengerRecord {
+        ArenaPtr<char> name;
+        uint32_t nameLength;
+        uint32_t pad;
+        int64_t balance;
+        ArenaPtr<PassengerRecord> next;  // creation order, which is account order
+    };
+
+    struct FlightRecord {
+        ArenaPtr<char> key;              // flightKey
+        uint32_t keyLength;
+        uint32_t ticketCount;
+        ArenaPtr<TicketRecord> firstTicket;
+        ArenaPtr<FlightRecord> next;
+    };
+
+    struct TicketRecord {
+        int32_t ticketID;
+        uint32_t account;                // position in the passenger list
+        int32_t row;
+        char letter;
+        char pad[3];
+        int64_t price;
+        ArenaPtr<FlightRecord> flight;
+        ArenaPtr<TicketRecord> prev;     // neighbours on the flight, or the free list
+        ArenaPtr<TicketRecord> next;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t layoutHash;             // record sizes this binary was built with
+        uint64_t totalBytes;
+        uint64_t generation;             // odd while a write is in progress
+        int64_t owner;                   // pid of the attached process
+        uint32_t broken;                 // set when a write could not be completed
+        uint32_t pad;
+        uint64_t used;                   // bump allocator
+        ArenaPtr<PassengerRecord> firstPassenger;
+        ArenaPtr<PassengerRecord> lastPassenger;
+        uint64_t passengerCount;
+        ArenaPtr<FlightRecord> firstFlight;
+        uint64_t flightCount;
+        ArenaPtr<TicketRecord> freeTickets;
+        uint64_t ticketCount;
+        int64_t lastTicketID;            // highest ticket ID ever issued, returned ones included
+    };
+
+    // A passenger or ticket as read back from the arena
+    struct Contents {
+        vector<pair<string, Cents>> passengers;  // in account order
+        struct Ticket {
+            int ticketID;
+            uint32_t account;
+            string date;
+            string flightNumber;
+            int row;
+            char letter;
+            Cents price;
+        };
+        vector<Ticket> tickets;
+        int lastTicketID = 0;
+    };
+
+    // Opens the named arena, creating an empty one of `bytes` if needed.
+    // The object is sparse, so unused space costs no memory.
+    StateArena(const string& name, size_t bytes = size_t(256) << 20) : name(name) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd == -1) throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+        File object(fd);
+        struct stat info;
+        if (fstat(fd, &info) != 0) throw std::runtime_error("fstat " + name + ": " + strerror(errno));
+        if (size_t(info.st_size) < sizeof(Header)) {
+            if (ftruncate(fd, off_t(bytes)) != 0) throw std::runtime_error("ftruncate " + name + ": " + strerror(errno));
+            size = bytes;
+        } else {
+            size = size_t(info.st_size);
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+        base = static_cast<char*>(mapping);
+        header = reinterpret_cast<Header*>(base);
+    }
+
+    // Releases the arena but leaves the state for the next process
+    ~StateArena() {
+        if (header->owner == getpid()) header->owner = 0;
+        munmap(base, size);
+    }
+
+    StateArena(const StateArena&) = delete;
+    StateArena& operator=(const StateArena&) = delete;
+
+    const string& path() const { return name; }
+
+    // Another live process is using this arena; it must not be touched
+    bool ownedByOtherProcess() const {
+        return memcmp(header->magic, Magic, sizeof(header->magic)) == 0 && header->owner != 0 &&
+               header->owner != getpid() && kill(pid_t(header->owner), 0) == 0;
+    }
+
+    // Checks the header and walks every record, bounds-checking each
+    // offset. On success fills `contents`, builds the lookup indexes and
+    // claims the arena for this process; otherwise explains in `reason`.
+    bool attach(Contents& contents, string& reason) {
+        if (memcmp(header->magic, Magic, sizeof(header->magic)) != 0) return fail(reason, "no saved state");
+        if (header->version != Version || header->layoutHash != layoutHash()) return fail(reason, "written by an incompatible build");
+        if (header->totalBytes != size || header->used > size || header->used < sizeof(Header)) return fail(reason, "size mismatch");
+        if (header->broken) return fail(reason, "a previous write did not fit");
+        if (header->generation & 1) return fail(reason, "the previous process stopped in the middle of an update");
+        if (ownedByOtherProcess()) return fail(reason, "still attached to running process " + to_string(header->owner));
+
+        clearIndexes();
+        uint64_t passengerCount = 0;
+        ArenaPtr<PassengerRecord> lastPassenger;
+        for (auto at = header->firstPassenger; at; ) {
+            const PassengerRecord* passenger = resolve(at);
+            if (!passenger || ++passengerCount > header->passengerCount) return fail(reason, "damaged passenger list");
+            string passengerName;
+            if (!readString(passenger->name, passenger->nameLength, passengerName)) return fail(reason, "damaged passenger name");
+            contents.passengers.emplace_back(passengerName, passenger->balance);
+            passengersByAccount.push_back(at);
+            lastPassenger = at;
+            at = passenger->next;
+        }
+        if (passengerCount != header->passengerCount) return fail(reason, "passenger count mismatch");
+        if (lastPassenger.offset != header->lastPassenger.offset) return fail(reason, "damaged passenger list tail");
+
+        uint64_t flightCount = 0, ticketCount = 0;
+        for (auto at = header->firstFlight; at; ) {
+            const FlightRecord* flight = resolve(at);
+            if (!flight || ++flightCount > header->flightCount) return fail(reason, "damaged flight list");
+            string key;
+            size_t space;
+            if (!readString(flight->key, flight->keyLength, key) || (space = key.find(' ')) == string::npos) {
+                return fail(reason, "damaged flight key");
+            }
+            flightsByKey[key] = at;
+            uint32_t onFlight = 0;
+            ArenaPtr<TicketRecord> previous;
+            for (auto ticketAt = flight->firstTicket; ticketAt; ) {
+                const TicketRecord* ticket = resolve(ticketAt);
+                if (!ticket || ++onFlight > flight->ticketCount || ticket->flight.offset != at.offset ||
+                    ticket->prev.offset != previous.offset || ticket->account >= passengerCount) {
+                    return fail(reason, "damaged ticket list");
+                }
+                if (ticketsByID.count(ticket->ticketID)) return fail(reason, "duplicate ticket ID " + to_string(ticket->ticketID));
+                contents.tickets.push_back(Contents::Ticket{ticket->ticketID, ticket->account, key.substr(0, space),
+                                                            key.substr(space + 1), ticket->row, ticket->letter,
+                                                            ticket->price});
+                ticketsByID[ticket->ticketID] = ticketAt;
+                previous = ticketAt;
+                ticketAt = ticket->next;
+            }
+            if (onFlight != flight->ticketCount) return fail(reason, "ticket count mismatch");
+            ticketCount += onFlight;
+            at = flight->next;
+        }
+        if (flightCount != header->flightCount || ticketCount != header->ticketCount) return fail(reason, "count mismatch");
+
+        // Freed records are reused by addTicket, so the free list must be
+        // as sound as the live lists: no cycles, no live tickets
+        uint64_t freeCount = 0, freeLimit = header->used / sizeof(TicketRecord);
+        unordered_set<uint64_t> live;
+        for (const auto& entry : ticketsByID) live.insert(entry.second.offset);
+        for (auto at = header->freeTickets; at; ) {
+            const TicketRecord* ticket = resolve(at);
+            if (!ticket || ++freeCount > freeLimit || live.count(at.offset)) return fail(reason, "damaged free list");
+            at = ticket->next;
+        }
+        contents.lastTicketID = int(header->lastTicketID);
+        header->owner = getpid();
+        return true;
+    }
+
+    // Starts over with an empty arena owned by this process
+    void reset() {
+        begin();
+        uint64_t generation = header->generation;
+        memset(static_cast<void*>(header), 0, sizeof(Header));
+        header->version = Version;
+        header->layoutHash = layoutHash();
+        header->totalBytes = size;
+        header->generation = generation;
+        header->owner = getpid();
+        header->used = (sizeof(Header) + 63) & ~size_t(63);
+        memcpy(header->magic, Magic, sizeof(header->magic));
+        clearIndexes();
+    }
+
+    // Writes below run under Program's ledgerMutex; commit() ends the
+    // critical section's update
+    void addPassenger(const string& passengerName, Cents balance) {
+        write([&] {
+            auto at = allocate<PassengerRecord>(sizeof(PassengerRecord));
+            PassengerRecord* passenger = resolve(at);
+            passenger->name = storeString(passengerName);
+            passenger->nameLength = uint32_t(passengerName.size());
+            passenger->balance = balance;
+            if (header->lastPassenger) {
+                resolve(header->lastPassenger)->next = at;
+            } else {
+                header->firstPassenger = at;
+            }
+            header->lastPassenger = at;
+            ++header->passengerCount;
+            passengersByAccount.push_back(at);
+        });
+    }
+
+    void setBalance(uint32_t account, Cents balance) {
+        write([&] {
+            if (account < passengersByAccount.size()) resolve(passengersByAccount[account])->balance = balance;
+        });
+    }
+
+    // Returns false, writing nothing, when `ticketID` is already stored
+    bool addTicket(int ticketID, uint32_t account, const string& date, const string& flightNumber, int row, char letter,
+                   Cents price) {
+        if (ticketsByID.count(ticketID)) return false;
+        write([&] {
+            ArenaPtr<FlightRecord> flightAt = flightRecord(flightKey(date, flightNumber));
+            ArenaPtr<TicketRecord> at = header->freeTickets;
+            const TicketRecord* freed = resolve(at);
+            if (freed) {
+                header->freeTickets = freed->next;
+            } else {
+                header->freeTickets = {};  // empty, or unusable; leak it rather than write through it
+                at = allocate<TicketRecord>(sizeof(TicketRecord));
+            }
+            TicketRecord* ticket = resolve(at);
+            FlightRecord* flight = resolve(flightAt);
+            *ticket = TicketRecord{ticketID, account, row, letter, {}, price, flightAt, {}, flight->firstTicket};
+            if (flight->firstTicket) resolve(flight->firstTicket)->prev = at;
+            flight->firstTicket = at;
+            ++flight->ticketCount;
+            ++header->ticketCount;
+            header->lastTicketID = max(header->lastTicketID, int64_t(ticketID));
+            ticketsByID[ticketID] = at;
+        });
+        return true;
+    }
+
+    void raiseLastTicketID(int ticketID) {
+        write([&] { header->lastTicketID = max(header->lastTicketID, int64_t(ticketID)); });
+    }
+
+    void removeTicket(int ticketID) {
+        write([&] {
+            auto found = ticketsByID.find(ticketID);
+            if (found == ticketsByID.end()) return;
+            ArenaPtr<TicketRecord> at = found->second;
+            TicketRecord* ticket = resolve(at);
+            FlightRecord* flight = resolve(ticket->flight);
+            if (ticket->prev) {
+                resolve(ticket->prev)->next = ticket->next;
+            } else {
+                flight->firstTicket = ticket->next;
+            }
+            if (ticket->next) resolve(ticket->next)->prev = ticket->prev;
+            --flight->ticketCount;
+            --header->ticketCount;
+            ticket->next = header->freeTickets;
+            header->freeTickets = at;
+            ticketsByID.erase(found);
+        });
+    }
+
+    // Marks the arena consistent again after a critical section wrote to it
+    void commit() {
+        if (!writing) return;
+        ++header->generation;
+        writing = false;
+    }
+
+    void report() const {
+        Console() << "State arena " << name << ": " << header->passengerCount << " passengers, " << header->ticketCount
+                  << " tickets on " << header->flightCount << " flights, " << header->used << "/" << size
+                  << " bytes, generation " << header->generation << (header->broken ? ", BROKEN (out of space)" : "")
+                  << "\n";
+    }
+
+private:
+    string name;
+    size_t size = 0;
+    char* base = nullptr;
+    Header* header = nullptr;
+    bool writing = false;
+    vector<ArenaPtr<PassengerRecord>> passengersByAccount;
+    unordered_map<string, ArenaPtr<FlightRecord>> flightsByKey;
+    unordered_map<int, ArenaPtr<TicketRecord>> ticketsByID;
+
+    static uint32_t layoutHash() {
+        uint32_t hash = 2166136261u;  // FNV-1a over the record sizes
+        for (size_t part : {sizeof(Header), sizeof(PassengerRecord), sizeof(FlightRecord), sizeof(TicketRecord)}) {
+            hash = (hash ^ uint32_t(part)) * 16777619u;
+        }
+        return hash;
+    }
+
+    static bool fail(string& reason, const string& why) {
+        reason = why;
+        return false;
+    }
+
+    void clearIndexes() {
+        passengersByAccount.clear();
+        flightsByKey.clear();
+        ticketsByID.clear();
+    }
+
+    template <typename T>
+    T* resolve(ArenaPtr<T> at) const {
+        if (!at || at.offset % alignof(uint64_t) != 0 || at.offset < sizeof(Header) || at.offset > header->used ||
+            header->used - at.offset < sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<T*>(base + at.offset);
+    }
+
+    bool readString(ArenaPtr<char> at, uint32_t length, string& out) const {
+        if (!at || at.offset < sizeof(Header) || at.offset > header->used || header->used - at.offset < length) return false;
+        out.assign(base + at.offset, length);
+        return true;
+    }
+
+    void begin() {
+        if (writing) return;
+        header->generation |= 1;
+        writing = true;
+    }
+
+    // Runs one update; an update that does not fit leaves the arena
+    // marked broken so the next start recovers from elsewhere
+    template <typename Fn>
+    void write(Fn update) {
+        if (header->broken) return;
+        begin();
+        try {
+            update();
+        } catch (const std::bad_alloc&) {
+            header->broken = 1;
+            Console() << "State arena " << name << " is full; restarts will recover from checkpoints instead.\n";
+        }
+    }
+
+    template <typename T>
+    ArenaPtr<T> allocate(size_t bytes) {
+        uint64_t offset = (header->used + 7) & ~uint64_t(7);
+        if (offset + bytes > size) throw std::bad_alloc();
+        header->used = offset + bytes;
+        return ArenaPtr<T>{offset};
+    }
+
+    ArenaPtr<char> storeString(const string& value) {
+        auto at = allocate<char>(value.size());
+        memcpy(base + at.offset, value.data(), value.size());
+        return at;
+    }
+
+    ArenaPtr<FlightRecord> flightRecord(const string& key) {
+        auto found = flightsByKey.find(key);
+        if (found != flightsByKey.end()) return found->second;
+        auto at = allocate<FlightRecord>(sizeof(FlightRecord));
+        FlightRecord* flight = resolve(at);
+        *flight = FlightRecord{storeString(key), uint32_t(key.size()), 0, {}, header->firstFlight};
+        header->firstFlight = at;
+        ++header->flightCount;
+        flightsByKey[key] = at;
+        return at;
+    }
+};
+
+// Append-only journal of balance movements. Columns are kept in separate
+// arrays so totals are a straight sum over one contiguous vector.
+class BalanceJournal {
+public:
+    enum Reason : uint8_t { Opening = 0, Deposit = 1, Booking = 2, Refund = 3 };
+
+    vector<uint32_t, CountingAllocator<uint32_t, MemoryTag::Ledger>> accounts;  // index into Program::passengers
+    vector<Cents, CountingAllocator<Cents, MemoryTag::Ledger>> amounts;        // credit > 0, debit < 0
+    vector<uint8_t, CountingAllocator<uint8_t, MemoryTag::Ledger>> reasons;
+    vector<int32_t, CountingAllocator<int32_t, MemoryTag::Ledger>> ticketIDs;
+
+    void append(uint32_t account, Cents amount, Reason reason, int ticketID = 0) {
+        accounts.push_back(account);
+        amounts.push_back(amount);
+        reasons.push_back(reason);
+        ticketIDs.push_back(ticketID);
+    }
+
+    size_t size() const {
+        return amounts.size();
+    }
+
+    // Net movement over the whole journal
+    Cents total() const {
+        Cents sum = 0;
+        for (Cents amount : amounts) sum += amount;
+        return sum;
+    }
+
+    // Net movement for one reason
+    Cents totalFor(Reason reason) const {
+        Cents sum = 0;
+        for (size_t i = 0; i < amounts.size(); ++i) {
+            sum += reasons[i] == reason ? amounts[i] : 0;
+        }
+        return sum;
+    }
+
+    void clear() {
+        accounts.clear();
+        amounts.clear();
+        reasons.clear();
+        ticketIDs.clear();
+    }
+};
+
+// One flight of a multi-flight itinerary
+struct ItineraryLeg {
+    string date;
+    string flightNumber;
+    int row;
+    char letter;
+};
+
+class Program {
+private:
+    string configPath;
+    shared_ptr<const FlightTable> flights;
+    atomic<uint64_t> flightsVersion{0};  // bumped after every table swap
+    uint64_t instanceId;                 // tells apart per-thread caches of different Programs
+    mutex reloadMutex;         // serializes config reloads and scheduled instantiations
+    ContendedMutex ledgerMutex;  // guards passengers, tickets and journal
+    StateArena* stateArena = nullptr;  // write-through copy of the ledger, guarded by ledgerMutex
+    PassengerList passengers;
+    TicketList tickets;
+    unordered_map<string, uint32_t> accountsByName;  // passenger name -> account, first one wins
+    unordered_map<int, uint32_t> ticketAccounts;  // live ticket ID -> owner's account
+    unordered_map<int, size_t> ticketPositions;   // live ticket ID -> index in tickets
+    int lastTicketID = 0;                          // highest ticket ID issued or restored
+    BalanceJournal journal;
+    ReplicationLog* replicationLog = nullptr;
+    AvailabilitySegment* availabilitySegment = nullptr;  // set once; republished with every table, under reloadMutex
+    bool readOnly = false;
+    mutex statsMutex;
+    map<string, function<void()>> statsSections;
+
+    // Seat holds awaiting payment, expired by holdWheel
+    struct SeatHold {
+        string flightNumber;
+        string date;
+        int row;
+        char letter;
+        string passengerName;
+        TimingWheel::TimerId timer;
+    };
+    static constexpr int HoldTickMillis = 100;
+    mutex holdsMutex;          // guards holds, holdWheel and nextHoldId
+    unordered_map<uint64_t, SeatHold, hash<uint64_t>, equal_to<uint64_t>,
+                  CountingAllocator<pair<const uint64_t, SeatHold>, MemoryTag::Indexes>> holds;
+    TimingWheel holdWheel;
+    uint64_t nextHoldId = 1;
+    chrono::steady_clock::time_point holdEpoch = chrono::steady_clock::now();
+    atomic<bool> stopping{false};
+    thread holdReaper;
+
+    // Background save progress, in a shared page the forked child updates
+    struct SaveProgress {
+        atomic<uint64_t> records{0};
+        atomic<uint64_t> totalRecords{0};
+        atomic<uint64_t> bytes{0};
+    };
+    struct SaveStatus {
+        bool running = false;
+        bool succeeded = false;
+        pid_t pid = 0;
+        string path;
+        chrono::steady_clock::time_point started;
+        double seconds = 0;
+        double pauseMillis = 0;  // how long writers were held off around fork()
+        uint64_t bytes = 0;
+    };
+    static const size_t SaveChunkBytes = 1 << 20;
+    mutex saveMutex;           // guards saveStatus and saveWaiter
+    SaveStatus saveStatus;
+    SaveProgress* saveProgress = nullptr;
+    thread saveWaiter;
+
+    // Incremental checkpoints. Flights and accounts touched since the last
+    // checkpoint are listed here, under ledgerMutex, so collecting a delta
+    // costs as much as the changes rather than the whole state.
+    struct CheckpointStats {
+        uint64_t deltas = 0;
+        uint64_t bases = 0;
+        uint64_t failures = 0;
+        size_t lastFlights = 0;
+        size_t lastAccounts = 0;
+        size_t lastBytes = 0;
+        double lastMillis = 0;
+        double lastPauseMillis = 0;  // time ledgerMutex was held to collect
+    };
+    static const size_t DeltasPerBase = 8;
+    CheckpointStore* checkpointStore = nullptr;
+    mutex checkpointMutex;     // serializes checkpoints; guards checkpointStats
+    CheckpointStats checkpointStats;
+    uint64_t checkpointEpoch = 1;
+    vector<string> dirtyFlights;            // flight keys
+    unordered_set<uint32_t> dirtyAccounts;  // indexes into passengers
+    bool checkpointEverything = true;       // next checkpoint writes a full base
+
+    // Holds ledgerMutex. State arena writes made while it is held become
+    // visible to a restarted process together or not at all.
+    class LedgerGuard {
+    public:
+        explicit LedgerGuard(Program& program) : program(program), guard(program.ledgerMutex) {}
+        ~LedgerGuard() {
+            if (program.stateArena) program.stateArena->commit();
+        }
+
+    private:
+        Program& program;
+        lock_guard<ContendedMutex> guard;
+    };
+
+public:
+    Program(const string& configFile) : Program(ConfigReader().parseSchedule(configFile), configFile) {}
+
+    // Builds the flights from specs directly; without a config path there
+    // is nothing to reload
+    explicit Program(const vector<FlightSpec>& specs, const string& configFile = "")
+        : Program(FlightSchedule{specs, {}}, configFile) {}
+
+    explicit Program(const FlightSchedule& schedule, const string& configFile = "") : configPath(configFile) {
+        static atomic<uint64_t> nextInstanceId{1};
+        instanceId = nextInstanceId++;
+        auto table = make_shared<FlightTable>();
+        for (const auto& spec : schedule.flights) {
+            table->flights[spec.key()] = FlightEntry{spec, ConfigReader::buildAirplane(spec)};
+        }
+        table->rules = schedule.rules;
+        flights = table;
+        holdReaper = thread([this] { reapHolds(); });
+        registerStats("holds", [this] {
+            lock_guard<mutex> holdGuard(holdsMutex);
+            Console() << "Seat holds: " << holds.size() << " outstanding\n";
+        });
+        registerStats("ledger", [this] {
+            LedgerGuard ledgerGuard(*this);
+            Cents balances = 0;
+            for (const auto& passenger : passengers) balances += passenger.balance;
+            Console() << "Ledger: " << journal.size() << " journal entries, deposits $"
+                 << Money{journal.totalFor(BalanceJournal::Deposit) + journal.totalFor(BalanceJournal::Opening)}
+                 << ", bookings $" << Money{-journal.totalFor(BalanceJournal::Booking)}
+                 << ", refunds $" << Money{journal.totalFor(BalanceJournal::Refund)}
+                 << ", balances $" << Money{balances}
+                 << (journal.total() == balances ? " (consistent)" : " (MISMATCH)") << "\n";
+        });
+        registerStats("memory", [this] { reportMemory(); });
+        registerStats("bgsave", [this] { reportBackgroundSave(); });
+        registerStats("checkpoint", [this] { reportCheckpoints(); });
+        registerStats("schedule", [this] {
+            shared_ptr<const FlightTable> table = currentFlights();
+            size_t dates = 0, instantiated = 0;
+            for (const auto& rule : table->rules) dates += rule.dateCount();
+            for (const auto& entry : table->flights) instantiated += entry.second.scheduled;
+            Console() << "Schedule: " << table->rules.size() << " rules covering " << dates << " flight dates, "
+                      << instantiated << " instantiated\n";
+        });
+    }
+
+    ~Program() {
+        stopping = true;
+        holdReaper.join();
+        if (saveWaiter.joinable()) saveWaiter.join();
+        if (saveProgress) munmap(saveProgress, sizeof(SaveProgress));
+    }
+
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    // Current flight table; safe to call while a reload is being published
+    shared_ptr<const FlightTable> currentFlights() const {
+        return atomic_load(&flights);
+    }
+
+    // Scheduled dates get their Airplane here on first use
+    shared_ptr<Airplane> findAirplane(const string& flightNumber, const string& date) {
+        TraceSpan span("flight lookup");
+        shared_ptr<const FlightTable> table = currentFlights();
+        shared_ptr<Airplane> airplane = table->find(flightNumber, date);
+        if (!airplane && table->ruleFor(flightNumber, date)) airplane = instantiateScheduled(flightNumber, date);
+        return airplane;
+    }
+
+    // Flight lookup for the read path. Each thread caches the table it last
+    // saw and only reloads it when flightsVersion moves, so readers touch no
+    // shared reference counts or locks. A scheduled date nobody has booked
+    // yet is answered from its rule's blank Airplane without building it.
+    // The pointer stays valid until the calling thread's next lookup.
+    const Airplane* findAirplaneForRead(const string& flightNumber, const string& date) const {
+        TraceSpan span("flight lookup");
+        struct TableCache {
+            uint64_t owner = 0;
+            uint64_t version = 0;
+            shared_ptr<const FlightTable> table;
+        };
+        thread_local TableCache cache;
+        uint64_t version = flightsVersion.load(memory_order_acquire);
+        if (cache.owner != instanceId || cache.version != version || !cache.table) {
+            cache.table = currentFlights();
+            cache.owner = instanceId;
+            cache.version = version;
+        }
+        auto it = cache.table->flights.find(flightKey(date, flightNumber));
+        if (it != cache.table->flights.end()) return it->second.airplane.get();
+        const ScheduleRule* rule = cache.table->ruleFor(flightNumber, date);
+        return rule ? rule->blank.get() : nullptr;
+    }
+
+    // Builds the Airplane for a date covered by a schedule rule and
+    // publishes a table containing it. Touched dates stay instantiated
+    // until a reload drops their rule.
+    shared_ptr<Airplane> instantiateScheduled(const string& flightNumber, const string& date) {
+        lock_guard<mutex> guard(reloadMutex);
+        shared_ptr<const FlightTable> current = currentFlights();
+        if (shared_ptr<Airplane> airplane = current->find(flightNumber, date)) return airplane;
+        const ScheduleRule* rule = current->ruleFor(flightNumber, date);
+        if (!rule) return nullptr;
+        FlightSpec spec = rule->on(date);
+        shared_ptr<Airplane> airplane = ConfigReader::buildAirplane(spec);
+        auto next = make_shared<FlightTable>(*current);
+        next->flights[spec.key()] = FlightEntry{spec, airplane, true};
+        atomic_store(&flights, shared_ptr<const FlightTable>(next));
+        flightsVersion.fetch_add(1, memory_order_release);
+        if (availabilitySegment) availabilitySegment->publish(*next);
+        return airplane;
+    }
+
+    // Re-reads the config file and applies the difference against the loaded
+    // flights. Unchanged flights keep their Airplane (and bookings); repriced
+    // flights are updated in place; flights whose seat grid changed are rebuilt
+    // with their bookings carried over seat by seat.
+    void reloadConfig() {
+        lock_guard<mutex> guard(reloadMutex);
+        FlightSchedule schedule;
+        try {
+            schedule = ConfigReader().parseSchedule(configPath);
+        } catch (const exception& e) {
+            Console() << "Config reload failed: " << e.what() << "\n";
+            return;
+        }
+
+        shared_ptr<const FlightTable> current = currentFlights();
+        auto next = make_shared<FlightTable>();
+        next->rules = schedule.rules;
+        int added = 0, repriced = 0, rebuilt = 0;
+        map<string, pair<Airplane*, Airplane*>> regridded;  // old and new Airplane, ordered by flight key
+        auto carry = [&](const FlightSpec& spec, bool scheduled) {
+            auto it = current->flights.find(spec.key());
+            if (it == current->flights.end()) {
+                next->flights[spec.key()] = FlightEntry{spec, ConfigReader::buildAirplane(spec), scheduled};
+                ++added;
+            } else if (!spec.sameGeometry(it->second.spec)) {
+                auto airplane = ConfigReader::buildAirplane(spec);
+                regridded[spec.key()] = {it->second.airplane.get(), airplane.get()};
+                next->flights[spec.key()] = FlightEntry{spec, airplane, scheduled};
+                ++rebuilt;
+            } else {
+                const auto& airplane = it->second.airplane;
+                if (!spec.samePrices(it->second.spec)) {
+                    lock_guard<ContendedMutex> seatGuard(airplane->lock);
+                    for (size_t tier = 0; tier < spec.ranges.size(); ++tier) {
+                        airplane->setTierPrice(tier, spec.ranges[tier].price);
+                    }
+                    ++repriced;
+                }
+                next->flights[spec.key()] = FlightEntry{spec, airplane, scheduled};
+            }
+        };
+        for (const auto& spec : schedule.flights) carry(spec, false);
+        // Dates already instantiated from a rule follow the rule that now covers them
+        for (const auto& entry : current->flights) {
+            if (!entry.second.scheduled || next->flights.count(entry.first)) continue;
+            const FlightSpec& spec = entry.second.spec;
+            if (const ScheduleRule* rule = next->ruleFor(spec.flightNumber, spec.date)) carry(rule->on(spec.date), true);
+        }
+        size_t removed = 0;
+        for (const auto& entry : current->flights) {
+            if (!next->flights.count(entry.first)) ++removed;
+        }
+
+        // Rebuilt flights keep their bookings. The old Airplanes stay locked
+        // until the new table is published so no booking lands in between.
+        vector<unique_lock<ContendedMutex>> seatGuards;
+        for (const auto& entry : regridded) seatGuards.emplace_back(entry.second.first->lock);
+        size_t moved = 0, cancelled = 0;
+        {
+            LedgerGuard ledgerGuard(*this);
+            for (const auto& entry : regridded) carryBookings(*entry.second.first, *entry.second.second, moved, cancelled);
+        }
+        atomic_store(&flights, shared_ptr<const FlightTable>(next));
+        flightsVersion.fetch_add(1, memory_order_release);
+        if (availabilitySegment) availabilitySegment->publish(*next);
+        seatGuards.clear();
+        {
+            // Replaced Airplanes are rewritten whole in the next checkpoint
+            LedgerGuard ledgerGuard(*this);
+            for (const auto& entry : next->flights) {
+                auto it = current->flights.find(entry.first);
+                if (it == current->flights.end() || it->second.airplane != entry.second.airplane) {
+                    markFlightDirty(*entry.second.airplane);
+                }
+            }
+        }
+        Console() << "Config reloaded: " << added << " added, " << removed << " removed, "
+             << repriced << " repriced, " << rebuilt << " rebuilt.\n";
+        if (moved || cancelled) Console() << "Bookings on rebuilt flights: " << moved << " kept, " << cancelled << " cancelled.\n";
+    }
+
+    // Lock waits summed over every flight's airplane lock
+    LockContention seatLockContention() const {
+        LockContention total;
+        for (const auto& entry : currentFlights()->flights) total += entry.second.airplane->lock.contention();
+        return total;
+    }
+
+    LockContention ledgerLockContention() const {
+        return ledgerMutex.contention();
+    }
+
+    // Find a passenger by name. Callers hold ledgerMutex.
+    Passenger* findPassenger(const string& name) {
+        auto account = accountsByName.find(name);
+        return account == accountsByName.end() ? nullptr : &passengers[account->second];
+    }
+
+    // Add a new passenger
+    void addPassenger(const string& name, Cents money) {
+        LedgerGuard ledgerGuard(*this);
+        passengers.push_back(Passenger(name));
+        accountsByName.emplace(name, accountOf(passengers.back()));
+        if (stateArena) stateArena->addPassenger(name, 0);
+        credit(passengers.back(), money, BalanceJournal::Opening);
+    }
+
+    // Adds money to a passenger's balance, creating the passenger if needed
+    void deposit(const string& name, Cents amount) {
+        if (readOnly) {
+            Console() << "Read-only replica: deposits must go to the primary.\n";
+            return;
+        }
+        if (amount <= 0) {
+            Console() << "Deposit amount must be positive.\n";
+            return;
+        }
+        LedgerGuard ledgerGuard(*this);
+        Passenger& passenger = findOrAddPassenger(name);
+        if (!credit(passenger, amount, BalanceJournal::Deposit)) {
+            Console() << "Deposit refused: " << name << "'s balance would overflow.\n";
+            return;
+        }
+        if (replicationLog) {
+            replicationLog->append(Mutation{Mutation::Deposit, 0, "", "", 0, 'A', name, amount});
+        }
+        Console() << "Deposited $" << Money{amount} << " for " << name << ". New balance: $"
+             << Money{passenger.balance} << "\n";
+    }
+
+    // Mirrors every flight's availability into `segment` from now on
+    void setAvailabilitySegment(AvailabilitySegment* segment) {
+        {
+            lock_guard<mutex> guard(reloadMutex);
+            availabilitySegment = segment;
+            segment->publish(*currentFlights());
+        }
+        registerStats("shm", [segment] { segment->report(); });
+    }
+
+    // Mutations are appended here when this process is a replication primary
+    void setReplicationLog(ReplicationLog* log) {
+        replicationLog = log;
+    }
+
+    // Followers reject book/return and only apply the primary's stream
+    void setReadOnly(bool value) {
+        readOnly = value;
+    }
+
+    // Registers a section for the `stats` command
+    void registerStats(const string& section, function<void()> report) {
+        lock_guard<mutex> guard(statsMutex);
+        statsSections[section] = move(report);
+    }
+
+    void showStats(const string& section) {
+        lock_guard<mutex> guard(statsMutex);
+        bool shown = false;
+        for (const auto& entry : statsSections) {
+            if (section.empty() || section == entry.first) {
+                entry.second();
+                shown = true;
+            }
+        }
+        if (!shown) Console() << "No stats available" << (section.empty() ? "" : " for " + section) << ".\n";
+    }
+
+    // Book a ticket for a passenger
+    void bookTicket(const string& flightNumber, const string& date, const string& seatNumber, char seatLetter, const string& passengerName) {
+        if (readOnly) {
+            Console() << "Read-only replica: bookings must go to the primary.\n";
+            return;
+        }
+        int ticketID = 0;
+        int row;
+        if (!parseRow(seatNumber, row)) {
+            Console() << "Invalid seat " << seatNumber << seatLetter << ".\n";
+            return;
+        }
+        int seatIndex = -1;
+        AIRFLIGHT_PROBE(book__start, date.c_str(), flightNumber.c_str(), row, seatLetter);
+        BookingStatus status = placeBooking(flightNumber, date, row, seatLetter, passengerName, ticketID, false, &seatIndex);
+        AIRFLIGHT_PROBE(book__done, date.c_str(), flightNumber.c_str(), seatIndex, int(status));
+        switch (status) {
+            case BookingStatus::Booked:
+                Console() << "Ticket booked successfully. Ticket ID: " << ticketID << "\n";
+                break;
+            case BookingStatus::FlightNotFound:
+                Console() << "Flight not found.\n";
+                break;
+            case BookingStatus::SeatUnavailable:
+                Console() << "Seat is unavailable or invalid.\n";
+                break;
+            case BookingStatus::InsufficientFunds:
+                Console() << "Insufficient balance for this seat.\n";
+                break;
+            case BookingStatus::DuplicateTicket:
+                break;
+        }
+    }
+
+
+    // The done probe reports the free seat count, or -1 for an unknown flight
+    void checkAvailability(const string& flightNumber, const string& date) {
+        AIRFLIGHT_PROBE(check__start, date.c_str(), flightNumber.c_str());
+        const Airplane* airplane = findAirplaneForRead(flightNumber, date);
+        if (airplane) {
+            Console() << "Available seats for flight " << flightNumber << " on " << date << ":\n";
+            airplane->displayAvailableSeats();
+            AIRFLIGHT_PROBE(check__done, date.c_str(), flightNumber.c_str(), int64_t(airplane->availableSeatCount()));
+            return;
+        }
+        Console() << "Flight not found.\n";
+        AIRFLIGHT_PROBE(check__done, date.c_str(), flightNumber.c_str(), int64_t(-1));
+    }
+
+    void returnTicket(int ticketID) {
+        if (readOnly) {
+            Console() << "Read-only replica: returns must go to the primary.\n";
+            return;
+        }
+        Ticket foundTicket;
+        Handover handover;
+        int seatIndex = -1;
+        AIRFLIGHT_PROBE(return__start, ticketID);
+        ReleaseStatus status = releaseTicket(ticketID, foundTicket, true, &handover, &seatIndex);
+        AIRFLIGHT_PROBE(return__done, foundTicket.flightDate.c_str(), foundTicket.flightNumber.c_str(), seatIndex, int(status));
+        switch (status) {
+            case ReleaseStatus::Released:
+                Console() << "Ticket returned successfully. Refund issued for $" << Money{foundTicket.price} << "\n";
+                if (handover.ticketID) {
+                    Console() << "Seat " << foundTicket.seat.number() << foundTicket.seat.letter() << " reassigned to "
+                         << handover.passengerName << " from the waitlist. Ticket ID: " << handover.ticketID << "\n";
+                }
+                break;
+            case ReleaseStatus::TicketNotFound:
+                Console() << "Ticket not found.\n";
+                break;
+            case ReleaseStatus::FlightNotFound:
+                Console() << "Flight " << foundTicket.flightNumber << " on " << foundTicket.flightDate
+                     << " is no longer scheduled; ticket not returned.\n";
+                break;
+        }
+    }
+
+    // Reserves a seat for `ttlSeconds`; the hold lapses unless confirmed
+    void holdSeat(const string& flightNumber, const string& date, const string& seatNumber, char seatLetter,
+                  const string& passengerName, int ttlSeconds) {
+        if (readOnly) {
+            Console() << "Read-only replica: holds must go to the primary.\n";
+            return;
+        }
+        shared_ptr<Airplane> airplane = findAirplane(flightNumber, date);
+        if (!airplane) {
+            Console() << "Flight not found.\n";
+            return;
+        }
+        int row;
+        if (!parseRow(seatNumber, row)) {
+            Console() << "Invalid seat " << seatNumber << seatLetter << ".\n";
+            return;
+        }
+        TraceSpan span("seat operation");
+        lock_guard<ContendedMutex> seatGuard(airplane->lock);
+        if (!airplane->holdSeat(row, seatLetter)) {
+            Console() << "Seat is unavailable or invalid.\n";
+            return;
+        }
+        uint64_t holdID;
+        {
+            lock_guard<mutex> holdGuard(holdsMutex);
+            holdID = nextHoldId++;
+            uint64_t expiry = holdTick() + (uint64_t(max(ttlSeconds, 1)) * 1000 + HoldTickMillis - 1) / HoldTickMillis;
+            holds[holdID] = SeatHold{flightNumber, date, row, seatLetter, passengerName, holdWheel.schedule(expiry, holdID)};
+        }
+        Console() << "Seat held. Hold ID: " << holdID << ", expires in " << max(ttlSeconds, 1) << " s\n";
+    }
+
+    // Turns a live hold into a ticket
+    void confirmHold(uint64_t holdID) {
+        if (readOnly) {
+            Console() << "Read-only replica: confirmations must go to the primary.\n";
+            return;
+        }
+        SeatHold hold;
+        {
+            lock_guard<mutex> holdGuard(holdsMutex);
+            auto it = holds.find(holdID);
+            if (it == holds.end()) {
+                Console() << "Hold not found or expired.\n";
+                return;
+            }
+            hold = it->second;
+        }
+        // The held bit decides races with expiry or a second confirm; the hold
+        // survives a failed payment so the passenger can top up and retry
+        int ticketID = 0;
+        switch (placeBooking(hold.flightNumber, hold.date, hold.row, hold.letter, hold.passengerName, ticketID, true)) {
+            case BookingStatus::Booked:
+                Console() << "Ticket booked successfully. Ticket ID: " << ticketID << "\n";
+                break;
+            case BookingStatus::InsufficientFunds:
+                Console() << "Insufficient balance for this seat; the hold is kept until it expires.\n";
+                return;
+            case BookingStatus::FlightNotFound:
+                Console() << "Flight " << hold.flightNumber << " on " << hold.date << " is no longer scheduled; hold released.\n";
                 break;
+            case BookingStatus::SeatUnavailable:
+                // Expiry or another confirm got there first, or a reload rebuilt the cabin
+                Console() << "Seat " << hold.row << hold.letter << " on flight " << hold.flightNumber
+                     << " is no longer held; no ticket was booked.\n";
+                break;
+            case BookingStatus::DuplicateTicket:
+                Console() << "Ticket ID already in use; no ticket was booked.\n";
+                break;
+        }
+        lock_guard<mutex> holdGuard(holdsMutex);
+        auto it = holds.find(holdID);
+        if (it != holds.end()) {
+            holdWheel.cancel(it->second.timer);
+            holds.erase(it);
+        }
+    }
+
+    // Queues a passenger for the next seat freed on a full flight
+    void joinWaitlist(const string& flightNumber, const string& date, const string& passengerName, int priority) {
+        if (readOnly) {
+            Console() << "Read-only replica: waitlist requests must go to the primary.\n";
+            return;
+        }
+        shared_ptr<Airplane> airplane = findAirplane(flightNumber, date);
+        if (!airplane) {
+            Console() << "Flight not found.\n";
+            return;
+        }
+        lock_guard<ContendedMutex> seatGuard(airplane->lock);
+        if (airplane->availableSeatCount() > 0) {
+            Console() << "Seats are still available on this flight; book one directly.\n";
+            return;
+        }
+        airplane->waitlist.push(Airplane::WaitlistEntry{priority, airplane->waitlistSequence++, passengerName});
+        Console() << "Added " << passengerName << " to the waitlist for flight " << flightNumber << " on " << date
+             << " (" << airplane->waitlist.size() << " waiting).\n";
+    }
+
+    // Books every leg or none. The involved flights are locked in key order,
+    // the same global order any multi-flight operation uses, so concurrent
+    // itineraries cannot deadlock; single-flight bookings lock only one.
+    void bookItinerary(const string& passengerName, const vector<ItineraryLeg>& legs) {
+        if (readOnly) {
+            Console() << "Read-only replica: bookings must go to the primary.\n";
+            return;
+        }
+        if (legs.empty()) {
+            Console() << "Itinerary has no flights.\n";
+            return;
+        }
+
+        map<string, Airplane*> involved;  // ordered by flight key
+        vector<shared_ptr<Airplane>> legAirplanes;
+        for (const auto& leg : legs) {
+            shared_ptr<Airplane> airplane = findAirplane(leg.flightNumber, leg.date);
+            if (!airplane) {
+                Console() << "Flight " << leg.flightNumber << " on " << leg.date << " not found; no tickets were booked.\n";
+                return;
+            }
+            involved[flightKey(leg.date, leg.flightNumber)] = airplane.get();
+            legAirplanes.push_back(airplane);
+        }
+
+        vector<unique_lock<ContendedMutex>> seatGuards;
+        for (const auto& entry : involved) {
+            seatGuards.emplace_back(entry.second->lock);
+        }
+
+        // Reserve every seat, undoing the ones already taken on failure
+        for (size_t i = 0; i < legs.size(); ++i) {
+            if (!legAirplanes[i]->bookSeat(legs[i].row, legs[i].letter)) {
+                while (i-- > 0) {
+                    legAirplanes[i]->returnSeat(legs[i].row, legs[i].letter);
+                }
+                Console() << "Seat is unavailable or invalid; no tickets were booked.\n";
+                return;
+            }
+        }
+
+        LedgerGuard ledgerGuard(*this);
+        Cents total = 0;
+        for (size_t i = 0; i < legs.size(); ++i) {
+            total += legAirplanes[i]->seatPrice(*legAirplanes[i]->findSeat(legs[i].row, legs[i].letter));
+        }
+        Passenger* passenger = findPassenger(passengerName);
+        if (!passenger || passenger->balance < total) {
+            for (size_t i = 0; i < legs.size(); ++i) {
+                legAirplanes[i]->returnSeat(legs[i].row, legs[i].letter);
+            }
+            Console() << "Insufficient balance for the itinerary ($" << Money{total} << "); no tickets were booked.\n";
+            return;
+        }
+        Console line;
+        line << "Itinerary booked successfully. Ticket IDs:";
+        for (size_t i = 0; i < legs.size(); ++i) {
+            int ticketID = nextTicketID();
+            debit(*passenger, legAirplanes[i]->seatPrice(*legAirplanes[i]->findSeat(legs[i].row, legs[i].letter)), ticketID);
+            issueTicket(ticketID, passengerName, *legAirplanes[i], *legAirplanes[i]->findSeat(legs[i].row, legs[i].letter));
+            line << ' ' << ticketID;
+        }
+        line << "\n";
+    }
+
+    // Applies a mutation received from the replication primary
+    void applyMutation(const Mutation& mutation) {
+        if (mutation.type == Mutation::Book) {
+            int ticketID = mutation.ticketID;
+            if (placeBooking(mutation.flightNumber, mutation.date, mutation.row, mutation.letter, mutation.passengerName,
+                             ticketID) == BookingStatus::DuplicateTicket) {
+                Console() << "Replication: ticket ID " << ticketID << " is already in use; booking skipped.\n";
+            }
+        } else if (mutation.type == Mutation::Return) {
+            Ticket returned;
+            releaseTicket(mutation.ticketID, returned, false);
+        } else if (mutation.type == Mutation::Deposit) {
+            LedgerGuard ledgerGuard(*this);
+            credit(findOrAddPassenger(mutation.passengerName), mutation.amount, BalanceJournal::Deposit);
+        }
+    }
+
+    // Serializes passengers and tickets. Seat availability is not stored; it
+    // follows from the tickets passengers currently hold. `logOffset` is set
+    // to the replication offset the snapshot corresponds to.
+    string snapshotState(uint64_t* logOffset = nullptr) {
+        LedgerGuard ledgerGuard(*this);
+        uint64_t offset = replicationLog ? replicationLog->head() : 0;
+        if (logOffset) *logOffset = offset;
+        BinaryWriter out;
+        encodeState(out, offset, [](BinaryWriter&) {});
+        return out.buffer;
+    }
+
+    // `bgsave <file>`: forks while holding ledgerMutex so the child sees a
+    // consistent state, then the child streams the snapshot to the file
+    // while this process keeps serving. Copy-on-write keeps the child's
+    // view frozen; the child writes in 1 MiB chunks so its own footprint,
+    // and the pages it dirties, stay small.
+    void backgroundSave(const string& path) {
+        lock_guard<mutex> saveGuard(saveMutex);
+        if (saveStatus.running) {
+            Console() << "Background save already in progress (pid " << int64_t(saveStatus.pid) << ").\n";
+            return;
+        }
+        if (!saveProgress) {
+            void* page = mmap(nullptr, sizeof(SaveProgress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (page == MAP_FAILED) {
+                Console() << "Background save failed: " << strerror(errno) << "\n";
+                return;
+            }
+            saveProgress = new (page) SaveProgress;
+        }
+        saveProgress->records = 0;
+        saveProgress->bytes = 0;
+
+        auto begin = chrono::steady_clock::now();
+        pid_t pid;
+        {
+            LedgerGuard ledgerGuard(*this);
+            uint64_t offset = replicationLog ? replicationLog->head() : 0;
+            saveProgress->totalRecords = tickets.size() + passengers.size();
+            pid = fork();
+            // The child only has this thread; it must not take locks that
+            // other threads may have held at the fork
+            if (pid == 0) _exit(writeSnapshotFile(path, offset));
+        }
+        double pauseMillis = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        if (pid < 0) {
+            Console() << "Background save failed: " << strerror(errno) << "\n";
+            return;
+        }
+
+        if (saveWaiter.joinable()) saveWaiter.join();
+        saveStatus = SaveStatus();
+        saveStatus.running = true;
+        saveStatus.pid = pid;
+        saveStatus.path = path;
+        saveStatus.started = begin;
+        saveStatus.pauseMillis = pauseMillis;
+        saveWaiter = thread([this, pid] {
+            int status = 0;
+            while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+            lock_guard<mutex> guard(saveMutex);
+            saveStatus.running = false;
+            saveStatus.succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            saveStatus.seconds = chrono::duration<double>(chrono::steady_clock::now() - saveStatus.started).count();
+            saveStatus.bytes = saveProgress->bytes;
+        });
+        Console() << "Background save started (pid " << int64_t(pid) << ").\n";
+    }
+
+    static constexpr char SnapshotMagic[] = "AFSNAP01";
+
+    // Replaces passengers, tickets and seat availability with a snapshot.
+    // Returns the replication offset stored in it.
+    uint64_t loadSnapshot(const string& data) {
+        BinaryReader in(data);
+        uint64_t offset = in.u64();
+        TicketList loadedTickets(in.u32());
+        for (auto& ticket : loadedTickets) {
+            ticket = decodeTicket(in);
+        }
+        PassengerList loadedPassengers;
+        for (uint32_t count = in.u32(); count > 0; --count) {
+            Passenger passenger(in.str());
+            passenger.balance = in.i64();
+            for (uint32_t held = in.u32(); held > 0; --held) {
+                passenger.addTicket(decodeTicket(in));
+            }
+            loadedPassengers.push_back(passenger);
+        }
+        int savedLastTicketID = in.atEnd() ? 0 : in.i32();  // older snapshots end here
+
+        // Scheduled dates must exist before the flights are locked
+        for (const auto& passenger : loadedPassengers) {
+            for (const auto& ticket : passenger.tickets) findAirplane(ticket.flightNumber, ticket.flightDate);
+        }
+        shared_ptr<const FlightTable> table = currentFlights();
+        vector<unique_lock<ContendedMutex>> seatGuards;
+        for (const auto& entry : table->flights) {
+            seatGuards.emplace_back(entry.second.airplane->lock);
+            entry.second.airplane->resetAvailability();
+        }
+        LedgerGuard ledgerGuard(*this);
+        passengers.swap(loadedPassengers);
+        tickets.swap(loadedTickets);
+        adoptLoadedState(*table, savedLastTicketID);
+        return offset;
+    }
+
+    // Takes passengers, balances and tickets from a state arena left by a
+    // previous process. Returns false, with the reason printed, when the
+    // arena is empty or fails validation; recovery then falls back to
+    // checkpoints or a snapshot.
+    bool resumeFromArena(StateArena& arena) {
+        auto begin = chrono::steady_clock::now();
+        StateArena::Contents contents;
+        string reason;
+        if (!arena.attach(contents, reason)) {
+            Console() << "State arena " << arena.path() << " not used: " << reason << ".\n";
+            return false;
+        }
+        for (const auto& ticket : contents.tickets) findAirplane(ticket.flightNumber, ticket.date);
+
+        shared_ptr<const FlightTable> table = currentFlights();
+        vector<unique_lock<ContendedMutex>> seatGuards;
+        for (const auto& entry : table->flights) {
+            seatGuards.emplace_back(entry.second.airplane->lock);
+            entry.second.airplane->resetAvailability();
+        }
+        LedgerGuard ledgerGuard(*this);
+        PassengerList loadedPassengers;
+        TicketList loadedTickets;
+        for (const auto& passenger : contents.passengers) {
+            loadedPassengers.push_back(Passenger(passenger.first));
+            loadedPassengers.back().balance = passenger.second;
+        }
+        size_t dropped = 0;
+        for (const auto& state : contents.tickets) {
+            shared_ptr<Airplane> airplane = table->find(state.flightNumber, state.date);
+            const Seat* seat = airplane ? airplane->findSeat(state.row, state.letter) : nullptr;
+            if (!seat) {
+                ++dropped;
+                continue;
+            }
+            Ticket ticket(state.ticketID, loadedPassengers[state.account].name, state.flightNumber, state.date, *seat,
+                          state.price);
+            loadedPassengers[state.account].addTicket(ticket);
+            loadedTickets.push_back(ticket);
+        }
+        passengers.swap(loadedPassengers);
+        tickets.swap(loadedTickets);
+        adoptLoadedState(*table, contents.lastTicketID);
+        // Tickets on flights that left the config must leave the arena too
+        stateArena = &arena;
+        if (dropped) rewriteStateArena();
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        Console() << "Resumed from state arena " << arena.path() << " in " << millis << " ms: " << passengers.size()
+                  << " passengers, " << tickets.size() << " tickets";
+        if (dropped) Console() << " (" << dropped << " on flights no longer configured were dropped)";
+        Console() << ".\n";
+        return true;
+    }
+
+    // Mirrors the ledger into `arena` from now on. Unless it was just
+    // resumed from, the arena is rewritten from the current state.
+    void setStateArena(StateArena* arena) {
+        {
+            LedgerGuard ledgerGuard(*this);
+            if (stateArena != arena) {
+                stateArena = arena;
+                rewriteStateArena();
+            }
+        }
+        registerStats("arena", [this] {
+            LedgerGuard ledgerGuard(*this);
+            stateArena->report();
+        });
+    }
+
+    // Checkpoints go to `store` from now on; the first one is a full base
+    void setCheckpointStore(CheckpointStore* store) {
+        checkpointStore = store;
+    }
+
+    // Writes the flights and balances changed since the previous
+    // checkpoint as a delta, or a new base when everything is dirty or
+    // enough deltas have piled up. Only collecting the changes happens
+    // under ledgerMutex; encoding and fsync run without it.
+    bool checkpoint(bool announce = true) {
+        if (!checkpointStore) {
+            if (announce) Console() << "Checkpoints are not enabled; start with --checkpoint-dir <dir>.\n";
+            return false;
+        }
+        lock_guard<mutex> checkpointGuard(checkpointMutex);
+        auto begin = chrono::steady_clock::now();
+        CheckpointImage image;
+        bool full = collectCheckpoint(image);
+        auto collected = chrono::steady_clock::now();
+
+        size_t bytes = 0;
+        try {
+            if (full) {
+                bytes = checkpointStore->writeBase(image);
+                checkpointStore->dropDeltas(image.sequence);
+                ++checkpointStats.bases;
+            } else {
+                bytes = checkpointStore->writeDelta(image);
+                ++checkpointStats.deltas;
+                if (checkpointStore->deltas().size() >= DeltasPerBase) {
+                    checkpointStore->mergeDeltas();
+                    ++checkpointStats.bases;
+                }
+            }
+        } catch (const exception& e) {
+            // The collected changes are lost from the dirty sets; start over
+            // from a full image next time
+            {
+                LedgerGuard ledgerGuard(*this);
+                checkpointEverything = true;
+            }
+            ++checkpointStats.failures;
+            Console() << "Checkpoint failed: " << e.what() << "\n";
+            return false;
+        }
+        auto end = chrono::steady_clock::now();
+        checkpointStats.lastFlights = image.flights.size();
+        checkpointStats.lastAccounts = image.balances.size();
+        checkpointStats.lastBytes = bytes;
+        checkpointStats.lastPauseMillis = chrono::duration<double, milli>(collected - begin).count();
+        checkpointStats.lastMillis = chrono::duration<double, milli>(end - begin).count();
+        if (announce) {
+            Console() << "Checkpoint " << image.sequence << (full ? " (base)" : " (delta)") << ": "
+                      << image.flights.size() << " flights, " << image.balances.size() << " accounts, "
+                      << bytes << " bytes.\n";
+        }
+        return true;
+    }
+
+    // Replaces passengers, tickets and seat availability with the merged
+    // checkpoint in `store`. Tickets on flights no longer configured are
+    // dropped, as with snapshots.
+    void restoreCheckpoint(const CheckpointStore& store) {
+        CheckpointImage image = store.load();
+        for (const auto& entry : image.flights) {
+            if (!entry.second.tickets.empty()) findAirplane(entry.second.flightNumber, entry.second.date);
+        }
+        shared_ptr<const FlightTable> table = currentFlights();
+        vector<unique_lock<ContendedMutex>> seatGuards;
+        for (const auto& entry : table->flights) {
+            seatGuards.emplace_back(entry.second.airplane->lock);
+            entry.second.airplane->resetAvailability();
+        }
+        LedgerGuard ledgerGuard(*this);
+        PassengerList loadedPassengers;
+        TicketList loadedTickets;
+        unordered_map<string, size_t> accounts;
+        for (const auto& balance : image.balances) {
+            accounts[balance.first] = loadedPassengers.size();
+            loadedPassengers.push_back(Passenger(balance.first));
+            loadedPassengers.back().balance = balance.second;
+        }
+        size_t restored = 0;
+        for (const auto& entry : image.flights) {
+            const auto& flight = entry.second;
+            shared_ptr<Airplane> airplane = table->find(flight.flightNumber, flight.date);
+            if (!airplane) continue;
+            for (const auto& state : flight.tickets) {
+                const Seat* seat = airplane->findSeat(state.row, state.letter);
+                if (!seat) continue;
+                auto account = accounts.find(state.passengerName);
+                if (account == accounts.end()) {
+                    account = accounts.emplace(state.passengerName, loadedPassengers.size()).first;
+                    loadedPassengers.push_back(Passenger(state.passengerName));
+                }
+                Ticket ticket(state.ticketID, state.passengerName, flight.flightNumber, flight.date, *seat, state.price);
+                loadedPassengers[account->second].addTicket(ticket);
+                loadedTickets.push_back(ticket);
+                ++restored;
+            }
+        }
+        passengers.swap(loadedPassengers);
+        tickets.swap(loadedTickets);
+        adoptLoadedState(*table, image.lastTicketID);
+        checkpointEpoch = image.sequence + 1;
+        Console() << "Restored checkpoint " << image.sequence << ": " << passengers.size() << " passengers, "
+                  << restored << " tickets.\n";
+    }
+
+    // View all tickets for a passenger
+    void viewBookedTickets(const string& passengerName) {
+        LedgerGuard ledgerGuard(*this);
+        Passenger* passenger = findPassenger(passengerName);
+        if (passenger) {
+            passenger->showTickets();
+        } else {
+            Console() << "Passenger not found!\n";
+        }
+    }
+
+    void viewTicket(int ticketID) {
+        LedgerGuard ledgerGuard(*this);
+        auto listed = ticketPositions.find(ticketID);
+        if (listed != ticketPositions.end()) {
+            tickets[listed->second].viewTicket();
+            return;
+        }
+        Console() << "Ticket ID not found.\n";
+    }
+
+    void viewByUsername(const string& username) {
+        LedgerGuard ledgerGuard(*this);
+        Passenger* passenger = findPassenger(username);
+        if (passenger) {
+            passenger->showTickets();
+        } else {
+            Console() << "Passenger not found.\n";
+        }
+    }
+
+    void viewByFlight(const string& date, const string& flightNumber) {
+        const Airplane* airplane = findAirplaneForRead(flightNumber, date);
+        if (airplane) {
+            Console() << "Available tickets for flight " << flightNumber << " on " << date << ":\n";
+            airplane->displayAvailableSeats();
+            return;
+        }
+        Console() << "Flight not found.\n";
+    }
+
+private:
+    enum class BookingStatus { Booked, FlightNotFound, SeatUnavailable, InsufficientFunds, DuplicateTicket };
+    enum class ReleaseStatus { Released, TicketNotFound, FlightNotFound };
+
+    // Waitlisted passenger who received a freed seat
+    struct Handover {
+        string passengerName;
+        int ticketID = 0;
+    };
+
+    // Reserves the seat and records the ticket under `ticketID`, or under a
+    // newly issued ID stored back in it when 0. Lock order is always the
+    // airplane first, then ledgerMutex.
+    // With `fromHold` the seat must currently be held rather than free.
+    // The resolved seat index is stored in `seatIndex` when given.
+    BookingStatus placeBooking(const string& flightNumber, const string& date, int row, char seatLetter,
+                               const string& passengerName, int& ticketID, bool fromHold = false,
+                               int* seatIndex = nullptr) {
+        shared_ptr<Airplane> airplane = findAirplane(flightNumber, date);
+        if (!airplane) return BookingStatus::FlightNotFound;
+
+        TraceSpan span("seat operation");
+        lock_guard<ContendedMutex> seatGuard(airplane->lock);
+        int index = airplane->seatIndex(row, seatLetter);
+        if (seatIndex) *seatIndex = index;
+        bool reservable = index >= 0 && (fromHold ? airplane->held.test(index) : airplane->availability.test(index));
+        if (!reservable) return BookingStatus::SeatUnavailable;
+        const Seat& seat = airplane->layout->seats[index];
+        Cents price = airplane->seatPrice(seat);
+
+        // Check and debit the balance while both locks are held
+        LedgerGuard ledgerGuard(*this);
+        Passenger* passenger = findPassenger(passengerName);
+        if (!passenger || passenger->balance < price) return BookingStatus::InsufficientFunds;
+        if (ticketID == 0) {
+            ticketID = nextTicketID();
+        } else if (ticketAccounts.count(ticketID)) {
+            return BookingStatus::DuplicateTicket;
+        }
+        if (fromHold) {
+            airplane->confirmHold(row, seatLetter);
+        } else {
+            airplane->bookSeat(row, seatLetter);
+        }
+        debit(*passenger, price, ticketID);
+        issueTicket(ticketID, passengerName, *airplane, seat);
+        return BookingStatus::Booked;
+    }
+
+    Passenger& findOrAddPassenger(const string& name) {
+        Passenger* passenger = findPassenger(name);
+        if (passenger) return *passenger;
+        passengers.push_back(Passenger(name));
+        accountsByName.emplace(name, accountOf(passengers.back()));
+        if (stateArena) stateArena->addPassenger(name, 0);
+        return passengers.back();
+    }
+
+    uint32_t accountOf(const Passenger& passenger) const {
+        return uint32_t(&passenger - passengers.data());
+    }
+
+    // Balance changes; callers hold ledgerMutex
+    // Refused when the balance plus the refunds the passenger's tickets may
+    // still bring would no longer fit in Cents; refunds themselves then
+    // cannot overflow
+    bool credit(Passenger& passenger, Cents amount, BalanceJournal::Reason reason, int ticketID = 0) {
+        Cents committed = passenger.balance;
+        for (const auto& ticket : passenger.tickets) {
+            if (__builtin_add_overflow(committed, ticket.price, &committed)) return false;
+        }
+        if (__builtin_add_overflow(committed, amount, &committed)) return false;
+        passenger.balance += amount;
+        journal.append(accountOf(passenger), amount, reason, ticketID);
+        dirtyAccounts.insert(accountOf(passenger));
+        if (stateArena) stateArena->setBalance(accountOf(passenger), passenger.balance);
+        return true;
+    }
+
+    void debit(Passenger& passenger, Cents amount, int ticketID) {
+        passenger.balance -= amount;
+        journal.append(accountOf(passenger), -amount, BalanceJournal::Booking, ticketID);
+        dirtyAccounts.insert(accountOf(passenger));
+        if (stateArena) stateArena->setBalance(accountOf(passenger), passenger.balance);
+    }
+
+    // Queues the flight for the next checkpoint. Callers hold ledgerMutex.
+    void markFlightDirty(Airplane& airplane) {
+        if (airplane.dirtyEpoch == checkpointEpoch) return;
+        airplane.dirtyEpoch = checkpointEpoch;
+        dirtyFlights.push_back(flightKey(airplane.date, airplane.flightNumber));
+    }
+
+    // Books seats and occupants for the tickets passengers now hold and
+    // rebuilds the journal, after passengers and tickets were replaced
+    // wholesale. A ticket ID held twice keeps its first holder. The ticket
+    // counter resumes above `savedLastTicketID` and every loaded ID.
+    // Callers hold every airplane lock and ledgerMutex, with availability
+    // already reset.
+    void adoptLoadedState(const FlightTable& table, int savedLastTicketID) {
+        accountsByName.clear();
+        for (const auto& passenger : passengers) accountsByName.emplace(passenger.name, accountOf(passenger));
+        ticketAccounts.clear();
+        lastTicketID = savedLastTicketID;
+        size_t duplicates = 0;
+        for (auto& passenger : passengers) {
+            auto& held = passenger.tickets;
+            held.erase(remove_if(held.begin(), held.end(), [&](const Ticket& ticket) {
+                bool taken = !ticketAccounts.emplace(ticket.ticketID, accountOf(passenger)).second;
+                duplicates += taken;
+                return taken;
+            }), held.end());
+        }
+        if (duplicates) Console() << "Dropped " << duplicates << " tickets whose IDs were already taken.\n";
+        tickets.clear();
+        ticketPositions.clear();
+        for (const auto& passenger : passengers) {
+            for (const auto& ticket : passenger.tickets) {
+                ticketPositions[ticket.ticketID] = tickets.size();
+                tickets.push_back(ticket);
+                lastTicketID = max(lastTicketID, ticket.ticketID);
+            }
+        }
+
+        for (const auto& entry : table.flights) entry.second.airplane->occupants.clear();
+        for (const auto& passenger : passengers) {
+            for (const auto& ticket : passenger.tickets) {
+                shared_ptr<Airplane> airplane = table.find(ticket.flightNumber, ticket.flightDate);
+                if (!airplane) continue;
+                int index = airplane->seatIndex(ticket.seat.row, ticket.seat.letter());
+                if (index < 0) continue;
+                airplane->bookSeat(ticket.seat.row, ticket.seat.letter());
+                airplane->occupants[index] = Airplane::Occupant{ticket.ticketID, accountOf(passenger), ticket.price};
+            }
+        }
+        journal.clear();
+        for (const auto& passenger : passengers) {
+            journal.append(accountOf(passenger), passenger.balance, BalanceJournal::Opening);
+        }
+        checkpointEverything = true;
+        if (stateArena) rewriteStateArena();
+    }
+
+    // Replaces the arena's contents with the current ledger. Callers hold
+    // ledgerMutex.
+    void rewriteStateArena() {
+        stateArena->reset();
+        stateArena->raiseLastTicketID(lastTicketID);
+        for (const auto& passenger : passengers) stateArena->addPassenger(passenger.name, passenger.balance);
+        for (const auto& passenger : passengers) {
+            for (const auto& ticket : passenger.tickets) {
+                stateArena->addTicket(ticket.ticketID, accountOf(passenger), ticket.flightDate, ticket.flightNumber,
+                                      ticket.seat.row, ticket.seat.letter(), ticket.price);
+            }
+        }
+    }
+
+    // Moves the dirty flights and accounts into `image` and starts a new
+    // epoch. Returns true when the image is complete and must be written
+    // as a base.
+    bool collectCheckpoint(CheckpointImage& image) {
+        LedgerGuard ledgerGuard(*this);
+        bool full = checkpointEverything;
+        image.sequence = checkpointEpoch;
+        image.lastTicketID = lastTicketID;
+        auto addFlight = [&](const Airplane& airplane) {
+            CheckpointImage::FlightState& flight = image.flights[flightKey(airplane.date, airplane.flightNumber)];
+            flight.date = airplane.date;
+            flight.flightNumber = airplane.flightNumber;
+            flight.tickets.reserve(airplane.occupants.size());
+            for (const auto& occupant : airplane.occupants) {
+                const Seat& seat = airplane.layout->seats[occupant.first];
+                flight.tickets.push_back(CheckpointImage::TicketState{occupant.second.ticketID, seat.row, seat.letter(),
+                                                                      passengers[occupant.second.account].name,
+                                                                      occupant.second.price});
+            }
+        };
+        shared_ptr<const FlightTable> table = currentFlights();
+        if (full) {
+            for (const auto& entry : table->flights) addFlight(*entry.second.airplane);
+            for (const auto& passenger : passengers) image.balances[passenger.name] = passenger.balance;
+        } else {
+            for (const auto& key : dirtyFlights) {
+                auto it = table->flights.find(key);
+                if (it != table->flights.end()) addFlight(*it->second.airplane);
+            }
+            for (uint32_t account : dirtyAccounts) {
+                image.balances[passengers[account].name] = passengers[account].balance;
+            }
+        }
+        dirtyFlights.clear();
+        dirtyAccounts.clear();
+        checkpointEverything = false;
+        ++checkpointEpoch;
+        return full;
+    }
+
+    void reportCheckpoints() {
+        lock_guard<mutex> checkpointGuard(checkpointMutex);
+        if (!checkpointStore) {
+            Console() << "Checkpoints: disabled\n";
+            return;
+        }
+        Console() << "Checkpoints: " << checkpointStats.deltas << " deltas and " << checkpointStats.bases
+                  << " bases written to " << checkpointStore->path() << ", " << checkpointStore->deltas().size()
+                  << " deltas pending merge, " << checkpointStats.failures << " failures\n";
+        if (checkpointStats.deltas + checkpointStats.bases > 0) {
+            Console() << "  last: " << checkpointStats.lastFlights << " flights, " << checkpointStats.lastAccounts
+                      << " accounts, " << checkpointStats.lastBytes << " bytes in " << checkpointStats.lastMillis
+                      << " ms (ledger held " << checkpointStats.lastPauseMillis << " ms)\n";
+        }
+    }
+
+    // Records a ticket for an already reserved seat and publishes it to
+    // followers. Callers hold the airplane lock and ledgerMutex.
+    void issueTicket(int ticketID, const string& passengerName, Airplane& airplane, const Seat& seat) {
+        TraceSpan span("ticket creation");
+        Ticket ticket(ticketID, passengerName, airplane.flightNumber, airplane.date, seat, airplane.seatPrice(seat));
+        Passenger& passenger = findOrAddPassenger(passengerName);
+        passenger.addTicket(ticket);
+        ticketPositions[ticketID] = tickets.size();
+        tickets.push_back(ticket);
+        ticketAccounts[ticketID] = accountOf(passenger);
+        lastTicketID = max(lastTicketID, ticketID);
+        airplane.occupants[airplane.seatIndex(seat.row, seat.letter())] =
+            Airplane::Occupant{ticketID, accountOf(passenger), ticket.price};
+        markFlightDirty(airplane);
+        if (stateArena) {
+            stateArena->addTicket(ticketID, accountOf(passenger), airplane.date, airplane.flightNumber, seat.row,
+                                  seat.letter(), ticket.price);
+        }
+        if (replicationLog) {
+            replicationLog->append(Mutation{Mutation::Book, ticketID, airplane.flightNumber, airplane.date,
+                                            seat.row, seat.letter(), passengerName});
+        }
+    }
+
+    // Frees the ticket's seat, drops it from its owner, refunds the price
+    // and, if the flight has a waitlist, books the seat for its head.
+    ReleaseStatus releaseTicket(int ticketID, Ticket& foundTicket, bool announceRefund = true, Handover* handover = nullptr,
+                                int* seatIndex = nullptr) {
+        {
+            LedgerGuard ledgerGuard(*this);
+            if (!findTicketOwner(ticketID, foundTicket)) return ReleaseStatus::TicketNotFound;
+        }
+
+        // Find the corresponding airplane and return the seat
+        shared_ptr<Airplane> airplane = findAirplane(foundTicket.flightNumber, foundTicket.flightDate);
+        if (!airplane) return ReleaseStatus::FlightNotFound;
+
+        TraceSpan span("seat operation");
+        lock_guard<ContendedMutex> seatGuard(airplane->lock);
+        LedgerGuard ledgerGuard(*this);
+        // Re-check now that both locks are held; a concurrent return may have won
+        Passenger* ticketOwner = findTicketOwner(ticketID, foundTicket);
+        if (!ticketOwner) return ReleaseStatus::TicketNotFound;
+
+        if (seatIndex) *seatIndex = airplane->seatIndex(foundTicket.seat.number(), foundTicket.seat.letter());
+        airplane->returnSeat(foundTicket.seat.number(), foundTicket.seat.letter());  // Return the seat in the airplane
+        airplane->occupants.erase(airplane->seatIndex(foundTicket.seat.number(), foundTicket.seat.letter()));
+        markFlightDirty(*airplane);
+        forgetTicket(*ticketOwner, foundTicket, announceRefund);
+        Handover given = handOverFreedSeat(*airplane, foundTicket.seat.row, foundTicket.seat.letter());
+        if (handover) *handover = given;
+        return ReleaseStatus::Released;
+    }
+
+    // Drops a ticket from its owner and the ledger and refunds its price.
+    // The seat itself is the caller's business. Callers hold ledgerMutex.
+    void forgetTicket(Passenger& owner, const Ticket& ticket, bool announceRefund) {
+        int ticketID = ticket.ticketID;
+        owner.returnTicket(ticketID);           // Remove the ticket from the passenger
+        ticketAccounts.erase(ticketID);
+        // Snapshots, checkpoints and the arena must all see it gone; order does not matter
+        auto listed = ticketPositions.find(ticketID);
+        if (listed != ticketPositions.end()) {
+            size_t position = listed->second;
+            ticketPositions.erase(listed);
+            if (position + 1 != tickets.size()) {
+                tickets[position] = tickets.back();
+                ticketPositions[tickets[position].ticketID] = position;
+            }
+            tickets.pop_back();
+        }
+        journal.append(accountOf(owner), ticket.price, BalanceJournal::Refund, ticketID);
+        dirtyAccounts.insert(accountOf(owner));
+        if (announceRefund) {
+            owner.refundMoney(ticket.price);   // Refund the ticket price to the passenger
+        } else {
+            owner.balance += ticket.price;
+        }
+        if (stateArena) {
+            stateArena->removeTicket(ticketID);
+            stateArena->setBalance(accountOf(owner), owner.balance);
+        }
+        if (replicationLog) {
+            replicationLog->append(Mutation{Mutation::Return, ticketID, ticket.flightNumber, ticket.flightDate,
+                                            ticket.seat.row, ticket.seat.letter(), owner.name});
+        }
+    }
+
+    // Moves the bookings of a flight whose seat grid changed onto its new
+    // Airplane, each to the same seat. A ticket whose seat is gone is
+    // refunded and dropped. Callers hold from's lock and ledgerMutex; `to`
+    // is not published yet.
+    void carryBookings(Airplane& from, Airplane& to, size_t& moved, size_t& refunded) {
+        for (const auto& entry : from.occupants) {
+            const Seat& seat = from.layout->seats[entry.first];
+            if (to.bookSeat(seat.row, seat.letter())) {
+                to.occupants[to.seatIndex(seat.row, seat.letter())] = entry.second;
+                ++moved;
+                continue;
+            }
+            Ticket ticket;
+            Passenger* owner = findTicketOwner(entry.second.ticketID, ticket);
+            if (!owner) continue;
+            Console() << "Seat " << seat.number() << seat.letter() << " no longer exists on flight " << from.flightNumber
+                 << " on " << from.date << "; ticket " << ticket.ticketID << " cancelled.\n";
+            forgetTicket(*owner, ticket, true);
+            ++refunded;
+        }
+    }
+
+    // Books a just-freed seat for the head of the flight's waitlist, inside
+    // the caller's critical section. Callers hold the airplane lock and
+    // ledgerMutex.
+    Handover handOverFreedSeat(Airplane& airplane, int row, char letter) {
+        Handover handover;
+        const Seat* seat = airplane.findSeat(row, letter);
+        if (!seat || !airplane.isSeatAvailable(row, letter)) return handover;
+        // Passengers who can no longer pay for the seat drop off the list
+        while (!airplane.waitlist.empty()) {
+            string name = airplane.waitlist.top().passengerName;
+            airplane.waitlist.pop();
+            Passenger* passenger = findPassenger(name);
+            Cents price = airplane.seatPrice(*seat);
+            if (!passenger || passenger->balance < price) continue;
+
+            airplane.bookSeat(row, letter);
+            handover.passengerName = name;
+            handover.ticketID = nextTicketID();
+            debit(*passenger, price, handover.ticketID);
+            issueTicket(handover.ticketID, name, airplane, *seat);
+            break;
+        }
+        return handover;
+    }
+
+    // Passengers and tickets; seat availability is rebuilt from the tickets
+    // on load. `afterRecord` runs after each ticket or passenger. Callers
+    // hold ledgerMutex, or are a bgsave child.
+    template <typename AfterRecord>
+    void encodeState(BinaryWriter& out, uint64_t logOffset, AfterRecord afterRecord) {
+        out.u64(logOffset);
+        out.u32(uint32_t(tickets.size()));
+        for (const auto& ticket : tickets) {
+            encodeTicket(out, ticket);
+            afterRecord(out);
+        }
+        out.u32(uint32_t(passengers.size()));
+        for (const auto& passenger : passengers) {
+            out.str(passenger.name);
+            out.i64(passenger.balance);
+            out.u32(uint32_t(passenger.tickets.size()));
+            for (const auto& ticket : passenger.tickets) {
+                encodeTicket(out, ticket);
+            }
+            afterRecord(out);
+        }
+        out.i32(lastTicketID);
+    }
+
+    // Runs in the bgsave child: the snapshot goes to `path`.tmp, which is
+    // renamed over `path` once complete. Returns the exit status.
+    int writeSnapshotFile(const string& path, uint64_t logOffset) {
+        try {
+            string temporary = path + ".tmp";
+            File file(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            bool ok = true;
+            auto spill = [&](BinaryWriter& out) {
+                ok = ok && writeFully(file, out.buffer.data(), out.buffer.size());
+                saveProgress->bytes.fetch_add(out.buffer.size(), memory_order_relaxed);
+                out.buffer.clear();
+            };
+            BinaryWriter out;
+            out.buffer.reserve(SaveChunkBytes + 4096);
+            out.raw(SnapshotMagic, sizeof(SnapshotMagic) - 1);
+            encodeState(out, logOffset, [&](BinaryWriter& chunk) {
+                saveProgress->records.fetch_add(1, memory_order_relaxed);
+                if (chunk.buffer.size() >= SaveChunkBytes) spill(chunk);
+            });
+            spill(out);
+            if (!ok || fsync(file.getFileDescriptor()) != 0) return 1;
+            return rename(temporary.c_str(), path.c_str()) == 0 ? 0 : 1;
+        } catch (...) {
+            return 1;
+        }
+    }
+
+    // Private_Dirty of the bgsave child: pages it wrote plus pages this
+    // process has written since the fork (each such write copies a page)
+    static int64_t unsharedKilobytes(pid_t pid) {
+        ifstream rollup("/proc/" + to_string(pid) + "/smaps_rollup");
+        string key;
+        int64_t value;
+        while (rollup >> key >> value) {
+            if (key == "Private_Dirty:") return value;
+            rollup.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+        return -1;
+    }
+
+    void reportBackgroundSave() {
+        lock_guard<mutex> guard(saveMutex);
+        if (saveStatus.path.empty()) {
+            Console() << "No background save yet.\n";
+            return;
+        }
+        if (saveStatus.running) {
+            double elapsed = chrono::duration<double>(chrono::steady_clock::now() - saveStatus.started).count();
+            Console line;
+            line << "Background save to " << saveStatus.path << ": running (pid " << int64_t(saveStatus.pid) << "), "
+                 << saveProgress->records.load() << " of " << saveProgress->totalRecords.load() << " records, "
+                 << saveProgress->bytes.load() << " bytes written, " << elapsed << " s elapsed, writers paused "
+                 << saveStatus.pauseMillis << " ms for the fork";
+            int64_t unshared = unsharedKilobytes(saveStatus.pid);
+            if (unshared >= 0) line << ", " << unshared << " KiB no longer shared";
+            line << "\n";
+            return;
+        }
+        Console() << "Last background save to " << saveStatus.path << ": "
+                  << (saveStatus.succeeded ? "succeeded, " : "failed, ") << saveStatus.bytes << " bytes in "
+                  << saveStatus.seconds << " s, writers paused " << saveStatus.pauseMillis << " ms for the fork\n";
+    }
+
+    // `stats memory`: live heap bytes per subsystem from the counting
+    // allocators, plus string overflow and object counts gathered here
+    void reportMemory() {
+        int64_t objects[int(MemoryTag::Count)] = {};
+        int64_t stringBytes[int(MemoryTag::Count)] = {};
+        shared_ptr<const FlightTable> table = currentFlights();
+        unordered_set<const CabinLayout*> layouts;
+        for (const auto& entry : table->flights) {
+            const Airplane& airplane = *entry.second.airplane;
+            objects[int(MemoryTag::Airplanes)] += 1;
+            if (layouts.insert(airplane.layout.get()).second) {
+                objects[int(MemoryTag::Seats)] += airplane.layout->configured.count();
+            }
+            objects[int(MemoryTag::Indexes)] += 1;
+            stringBytes[int(MemoryTag::Airplanes)] += stringHeapBytes(airplane.flightNumber) + stringHeapBytes(airplane.date);
+            stringBytes[int(MemoryTag::Indexes)] += stringHeapBytes(entry.first);
+        }
+        {
+            lock_guard<mutex> holdGuard(holdsMutex);
+            objects[int(MemoryTag::Indexes)] += holds.size();
+        }
+        {
+            LedgerGuard ledgerGuard(*this);
+            objects[int(MemoryTag::Passengers)] = passengers.size();
+            objects[int(MemoryTag::Ledger)] = journal.size();
+            auto ticketStrings = [](const Ticket& ticket) {
+                return stringHeapBytes(ticket.passengerName) + stringHeapBytes(ticket.flightNumber)
+                     + stringHeapBytes(ticket.flightDate);
+            };
+            for (const auto& passenger : passengers) {
+                stringBytes[int(MemoryTag::Passengers)] += stringHeapBytes(passenger.name);
+                objects[int(MemoryTag::Tickets)] += passenger.tickets.size();
+                for (const auto& ticket : passenger.tickets) stringBytes[int(MemoryTag::Tickets)] += ticketStrings(ticket);
+            }
+            objects[int(MemoryTag::Tickets)] += tickets.size();
+            for (const auto& ticket : tickets) stringBytes[int(MemoryTag::Tickets)] += ticketStrings(ticket);
+        }
+
+        int64_t totalBytes = 0;
+        Console() << "Memory by subsystem (live heap bytes, blocks, objects):\n";
+        for (int tag = 0; tag < int(MemoryTag::Count); ++tag) {
+            int64_t bytes = memoryUsage[tag].bytes.load(memory_order_relaxed) + stringBytes[tag];
+            totalBytes += bytes;
+            Console() << "  " << memoryTagNames[tag] << ": " << bytes << " bytes, "
+                 << memoryUsage[tag].blocks.load(memory_order_relaxed) << " blocks, " << objects[tag] << " objects\n";
+        }
+        Console() << "  total: " << totalBytes << " bytes\n";
+        Console() << "  cabin layouts: " << layouts.size() << " shared by " << table->flights.size() << " flights\n";
+    }
+
+    uint64_t holdTick() const {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - holdEpoch).count() / HoldTickMillis;
+    }
+
+    // Background thread: advances the wheel and releases lapsed holds
+    void reapHolds() {
+        vector<SeatHold> expired;
+        while (!stopping) {
+            this_thread::sleep_for(chrono::milliseconds(HoldTickMillis));
+            {
+                lock_guard<mutex> holdGuard(holdsMutex);
+                holdWheel.advance(holdTick(), [&](uint64_t holdID) {
+                    auto it = holds.find(holdID);
+                    if (it == holds.end()) return;
+                    expired.push_back(it->second);
+                    holds.erase(it);
+                });
+            }
+            for (const auto& hold : expired) {
+                shared_ptr<Airplane> airplane = findAirplane(hold.flightNumber, hold.date);
+                if (!airplane) continue;
+                lock_guard<ContendedMutex> seatGuard(airplane->lock);
+                airplane->releaseHold(hold.row, hold.letter);
+                LedgerGuard ledgerGuard(*this);
+                Handover handover = handOverFreedSeat(*airplane, hold.row, hold.letter);
+                if (handover.ticketID) {
+                    Console() << "Expired hold on seat " << hold.row << hold.letter << " of flight " << hold.flightNumber
+                         << " reassigned to " << handover.passengerName << " from the waitlist. Ticket ID: "
+                         << handover.ticketID << "\n";
+                }
+            }
+            expired.clear();
+        }
+    }
+
+    // Find the passenger who owns the ticket. Callers hold ledgerMutex.
+    Passenger* findTicketOwner(int ticketID, Ticket& foundTicket) {
+        auto owner = ticketAccounts.find(ticketID);
+        if (owner == ticketAccounts.end()) return nullptr;
+        Passenger& passenger = passengers[owner->second];
+        return passenger.findTicket(ticketID, foundTicket) ? &passenger : nullptr;
+    }
+
+    // Next unused ticket ID. IDs only grow, across restarts too, since the
+    // counter is saved with the arena, checkpoints and snapshots. Callers
+    // hold ledgerMutex.
+    int nextTicketID() {
+        do {
+            ++lastTicketID;
+        } while (ticketAccounts.count(lastTicketID));
+        return lastTicketID;
+    }
+
+    static void encodeTicket(BinaryWriter& out, const Ticket& ticket) {
+        out.i32(ticket.ticketID);
+        out.str(ticket.passengerName);
+        out.str(ticket.flightNumber);
+        out.str(ticket.flightDate);
+        out.i32(ticket.seat.row);
+        out.u8(uint8_t(ticket.seat.letter()));
+        out.i64(ticket.price);
+    }
+
+    static Ticket decodeTicket(BinaryReader& in) {
+        int ticketID = in.i32();
+        string passengerName = in.str();
+        string flightNumber = in.str();
+        string flightDate = in.str();
+        int row = in.i32();
+        char letter = char(in.u8());
+        Cents price = in.i64();
+        Seat seat(row, letter, 0);
+        seat.book();
+        return Ticket(ticketID, passengerName, flightNumber, flightDate, seat, price);
+    }
+};
+
+// Frame types of the replication protocol
+enum ReplicationFrame : uint8_t {
+    FrameHello = 1,      // follower -> primary: u64 last applied offset
+    FrameSnapshot = 2,   // primary -> follower: snapshot bytes
+    FrameMutation = 3,   // primary -> follower: u64 offset, i64 timestamp, mutation
+    FrameHeartbeat = 4,  // primary -> follower: u64 head offset, i64 timestamp
+    FrameAck = 5         // follower -> primary: u64 last applied offset
+};
+
+// Serves the replication log to followers over a Unix domain socket. Each
+// follower gets its own sender thread: a snapshot if it is too far behind,
+// then every mutation after its offset.
+class ReplicationPrimary {
+public:
+    ReplicationPrimary(Program& program, ReplicationLog& log, const string& socketPath)
+        : program(program), log(log), socketPath(socketPath), stopping(false), nextFollowerId(1) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) throw std::runtime_error("Failed to create replication socket");
+        listener = File(fd);
+        sockaddr_un address = unixAddress(socketPath);
+        unlink(socketPath.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 || listen(fd, 16) == -1) {
+            throw std::runtime_error("Failed to listen on " + socketPath);
+        }
+        acceptor = thread([this] { acceptLoop(); });
+        program.registerStats("replication", [this] { report(); });
+    }
+
+    ~ReplicationPrimary() {
+        stopping = true;
+        shutdown(listener.getFileDescriptor(), SHUT_RDWR);
+        acceptor.join();
+        {
+            lock_guard<mutex> guard(followersMutex);
+            for (auto& follower : followers) shutdown(follower.second.connection->getFileDescriptor(), SHUT_RDWR);
+        }
+        for (auto& sender : senders) sender.second.join();
+        unlink(socketPath.c_str());
+    }
+
+    static sockaddr_un unixAddress(const string& path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        return address;
+    }
+
+private:
+    struct FollowerState {
+        shared_ptr<File> connection;
+        atomic<uint64_t> acked{0};
+    };
+
+    Program& program;
+    ReplicationLog& log;
+    string socketPath;
+    File listener{-1};
+    atomic<bool> stopping;
+    thread acceptor;
+    mutex followersMutex;                  // guards followers, senders and finishedSenders
+    map<int, FollowerState> followers;
+    map<int, thread> senders;              // per connection, until reaped
+    vector<int> finishedSenders;           // connections whose sender has returned
+    int nextFollowerId;
+
+    void acceptLoop() {
+        while (!stopping) {
+            int fd = accept(listener.getFileDescriptor(), nullptr, nullptr);
+            if (fd == -1) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            reapSenders();
+            lock_guard<mutex> guard(followersMutex);
+            int id = nextFollowerId++;
+            followers[id].connection = make_shared<File>(fd);
+            senders[id] = thread([this, id] { serve(id); });
+        }
+    }
+
+    // Joins the senders of closed connections, so a follower that keeps
+    // reconnecting does not pile up finished threads
+    void reapSenders() {
+        vector<thread> finished;
+        {
+            lock_guard<mutex> guard(followersMutex);
+            for (int id : finishedSenders) {
+                auto it = senders.find(id);
+                if (it == senders.end()) continue;
+                finished.push_back(move(it->second));
+                senders.erase(it);
+            }
+            finishedSenders.clear();
+        }
+        for (auto& sender : finished) sender.join();
+    }
+
+    void serve(int id) {
+        shared_ptr<File> connection;
+        {
+            lock_guard<mutex> guard(followersMutex);
+            connection = followers[id].connection;
+        }
+        uint8_t type;
+        string payload;
+        if (readFrame(*connection, type, payload) && type == FrameHello) {
+            uint64_t offset = BinaryReader(payload).u64();
+            thread ackReader([this, id, connection] { readAcks(id, *connection); });
+            stream(*connection, offset);
+            shutdown(connection->getFileDescriptor(), SHUT_RDWR);
+            ackReader.join();
+        }
+        lock_guard<mutex> guard(followersMutex);
+        followers.erase(id);
+        finishedSenders.push_back(id);
+    }
+
+    // Sends everything after `offset`, falling back to a snapshot when the
+    // follower is ahead of us (a different primary) or the log was trimmed
+    void stream(File& connection, uint64_t offset) {
+        vector<string> entries;
+        if (offset > log.head() || !log.readAfter(offset, entries, chrono::milliseconds(0))) {
+            if (!writeFrame(connection, FrameSnapshot, program.snapshotState(&offset))) return;
+            entries.clear();
+        }
+        while (!stopping) {
+            if (entries.empty() && !log.readAfter(offset, entries, chrono::milliseconds(500))) {
+                if (!writeFrame(connection, FrameSnapshot, program.snapshotState(&offset))) return;
+                continue;
+            }
+            if (entries.empty()) {
+                BinaryWriter heartbeat;
+                heartbeat.u64(log.head());
+                heartbeat.i64(wallClockNanos());
+                if (!writeFrame(connection, FrameHeartbeat, heartbeat.buffer)) return;
+                continue;
+            }
+            for (const auto& entry : entries) {
+                BinaryWriter frame;
+                frame.u64(++offset);
+                frame.raw(entry.data(), entry.size());
+                if (!writeFrame(connection, FrameMutation, frame.buffer)) return;
+            }
+            entries.clear();
+        }
+    }
+
+    void readAcks(int id, File& connection) {
+        uint8_t type;
+        string payload;
+        while (readFrame(connection, type, payload)) {
+            if (type != FrameAck) continue;
+            lock_guard<mutex> guard(followersMutex);
+            followers[id].acked = BinaryReader(payload).u64();
+        }
+    }
+
+    void report() {
+        uint64_t head = log.head();
+        lock_guard<mutex> guard(followersMutex);
+        Console() << "Replication primary: head offset " << head << ", " << followers.size() << " follower(s)\n";
+        for (const auto& follower : followers) {
+            uint64_t acked = follower.second.acked;
+            Console() << "  follower " << follower.first << ": acked " << acked << ", lag " << head - acked << " mutation(s)\n";
+        }
+    }
+};
+
+// Connects to a primary, applies its stream to the local Program and
+// reconnects from the last applied offset if the connection drops
+class ReplicationFollower {
+public:
+    ReplicationFollower(Program& program, const string& socketPath)
+        : program(program), socketPath(socketPath), stopping(false),
+          appliedOffset(0), primaryOffset(0), lastAppliedStamp(0), lastPrimaryStamp(0), connected(false) {
+        program.setReadOnly(true);
+        program.registerStats("replication", [this] { report(); });
+        worker = thread([this] { run(); });
+    }
+
+    ~ReplicationFollower() {
+        stopping = true;
+        {
+            lock_guard<mutex> guard(connectionMutex);
+            if (connection) shutdown(connection->getFileDescriptor(), SHUT_RDWR);
+        }
+        worker.join();
+    }
+
+private:
+    Program& program;
+    string socketPath;
+    atomic<bool> stopping;
+    thread worker;
+    mutex connectionMutex;
+    shared_ptr<File> connection;
+    atomic<uint64_t> appliedOffset;
+    atomic<uint64_t> primaryOffset;
+    atomic<int64_t> lastAppliedStamp;  // primary timestamp of the last applied mutation
+    atomic<int64_t> lastPrimaryStamp;  // primary timestamp of the newest frame seen
+    atomic<bool> connected;
+
+    void run() {
+        while (!stopping) {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address = ReplicationPrimary::unixAddress(socketPath);
+            if (fd == -1 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+                if (fd != -1) close(fd);
+                this_thread::sleep_for(chrono::milliseconds(500));
+                continue;
+            }
+            {
+                lock_guard<mutex> guard(connectionMutex);
+                connection = make_shared<File>(fd);
+            }
+            connected = true;
+            follow(*connection);
+            connected = false;
+        }
+    }
+
+    void follow(File& link) {
+        BinaryWriter hello;
+        hello.u64(appliedOffset);
+        if (!writeFrame(link, FrameHello, hello.buffer)) return;
+
+        uint8_t type;
+        string payload;
+        while (!stopping && readFrame(link, type, payload)) {
+            BinaryReader in(payload);
+            if (type == FrameSnapshot) {
+                appliedOffset = program.loadSnapshot(payload);
+                primaryOffset = max<uint64_t>(primaryOffset, appliedOffset);
+            } else if (type == FrameMutation) {
+                uint64_t offset = in.u64();
+                int64_t stamp = in.i64();
+                program.applyMutation(Mutation::decode(in));
+                appliedOffset = offset;
+                lastAppliedStamp = stamp;
+                lastPrimaryStamp = max<int64_t>(lastPrimaryStamp, stamp);
+                primaryOffset = max<uint64_t>(primaryOffset, offset);
+            } else if (type == FrameHeartbeat) {
+                primaryOffset = in.u64();
+                lastPrimaryStamp = in.i64();
+            }
+            BinaryWriter ack;
+            ack.u64(appliedOffset);
+            if (!writeFrame(link, FrameAck, ack.buffer)) return;
+        }
+    }
+
+    void report() {
+        uint64_t applied = appliedOffset, head = max<uint64_t>(primaryOffset, applied);
+        double lagMs = 0.0;
+        if (head > applied && lastAppliedStamp > 0) {
+            lagMs = (wallClockNanos() - lastAppliedStamp) / 1e6;
+        }
+        Console() << "Replication follower (" << (connected ? "connected" : "disconnected") << "): applied offset "
+             << applied << ", primary offset " << head << ", lag " << head - applied << " mutation(s), "
+             << lagMs << " ms\n";
+    }
+};
+
+// `--record <file>`: appends every command line InputReader::record sees
+// (from the interactive loop, the server, --pipeline and --parallel) to a
+// compact binary trace. The file starts with
+// "AFTRACE1"; each record is a varint nanosecond delta from the previous
+// command followed by the length-prefixed line.
+class CommandRecorder {
+public:
+    static constexpr char Magic[] = "AFTRACE1";
+    static const size_t FlushBytes = 64 * 1024;
+
+    explicit CommandRecorder(const string& path)
+        : file(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644), last(chrono::steady_clock::now()) {
+        out.raw(Magic, sizeof(Magic) - 1);
+    }
+
+    ~CommandRecorder() {
+        lock_guard<mutex> guard(lock);
+        flush();
+    }
+
+    CommandRecorder(const CommandRecorder&) = delete;
+    CommandRecorder& operator=(const CommandRecorder&) = delete;
+
+    // Server connections record concurrently
+    void record(const string& line) {
+        lock_guard<mutex> guard(lock);
+        auto now = chrono::steady_clock::now();
+        out.varint(chrono::duration_cast<chrono::nanoseconds>(now - last).count());
+        out.varint(line.size());
+        out.buffer.append(line);
+        last = now;
+        if (out.buffer.size() >= FlushBytes) flush();
+    }
+
+private:
+    void flush() {
+        if (!out.buffer.empty() && !writeFully(file, out.buffer.data(), out.buffer.size())) {
+            Console() << "Could not write the command trace: " << strerror(errno) << "\n";
+        }
+        out.buffer.clear();
+    }
+
+    File file;
+    BinaryWriter out;
+    chrono::steady_clock::time_point last;
+    mutex lock;
+};
+
+static const char commandPrompt[] = "Enter a command (check, deposit, book, hold, confirm, waitlist, return, view, trace, exit): ";
+
+// A command line broken into its fields
+struct Command {
+    enum Kind { None, Book, BookItinerary, Check, Return, Hold, Confirm, Deposit, Waitlist, Stats,
+                ViewID, ViewUsername, ViewFlight, Trace, Bgsave, Checkpoint, Invalid, Exit };
+
+    Kind kind = None;
+    string date;
+    string flightNumber;
+    string seatNumber;
+    char seatLetter = 0;
+    string passengerName;
+    int ticketID = 0;
+    uint64_t holdID = 0;
+    int ttlSeconds = 300;
+    int priority = 0;
+    Cents amount = 0;
+    vector<ItineraryLeg> legs;
+    string argument;  // stats section, trace action, or the error for Invalid
+    string path;      // trace dump or bgsave target
+};
+
+class InputReader {
+    public:
+        void processInput(const string& input, Program& program) {
+            record(input);
+            TraceSpan commandSpan("command");
+            Command command;
+            {
+                TraceSpan parseSpan("parse");
+                command = parse(input);
+            }
+            execute(command, program);
+        }
+
+        // Splits the seat id ("12C") into number and letter
+        static bool splitSeat(const string& seatStr, string& seatNumber, char& seatLetter) {
+            size_t pos = seatStr.find_first_not_of("0123456789");
+            if (pos == 0 || pos == string::npos) return false;
+            seatNumber = seatStr.substr(0, pos);
+            seatLetter = seatStr[pos];
+            return true;
+        }
+
+        Command parse(const string& input) const {
+            istringstream iss(input);
+            string word;
+            iss >> word;
+            Command command;
+
+            if (word == "book") {
+                string seatStr;
+                iss >> command.date >> command.flightNumber >> seatStr;
+                command.kind = splitSeat(seatStr, command.seatNumber, command.seatLetter) ? Command::Book : Command::Invalid;
+
+                // Assuming passenger name is the remaining part of the string
+                getline(iss, command.passengerName);
+                command.passengerName.erase(0, command.passengerName.find_first_not_of(" "));
+            }
+            else if (word == "book-itinerary") {
+                string date, flightNumber, seatStr, seatNumber;
+                char seatLetter;
+                int row;
+                command.kind = Command::BookItinerary;
+                iss >> command.passengerName;
+                while (iss >> date >> flightNumber >> seatStr) {
+                    if (!splitSeat(seatStr, seatNumber, seatLetter) || !parseRow(seatNumber, row)) {
+                        command.kind = Command::Invalid;
+                        command.argument = "Invalid seat " + seatStr + ".";
+                        break;
+                    }
+                    command.legs.push_back(ItineraryLeg{date, flightNumber, row, seatLetter});
+                }
+            }
+            else if (word == "check") {
+                command.kind = Command::Check;
+                iss >> command.date >> command.flightNumber;
+            }
+            else if (word == "return") {
+                command.kind = Command::Return;
+                iss >> command.ticketID;
+            }
+            else if (word == "hold") {
+                string seatStr;
+                iss >> command.date >> command.flightNumber >> seatStr >> command.passengerName;
+                iss >> command.ttlSeconds;
+                command.kind = splitSeat(seatStr, command.seatNumber, command.seatLetter) ? Command::Hold : Command::Invalid;
+            }
+            else if (word == "confirm") {
+                command.kind = Command::Confirm;
+                iss >> command.holdID;
+            }
+            else if (word == "deposit") {
+                // The amount is the last word; the name before it may have spaces, as with book
+                string rest, amount;
+                getline(iss, rest);
+                rest.erase(rest.find_last_not_of(" ") + 1);
+                size_t split = rest.find_last_of(' ');
+                if (split != string::npos) {
+                    amount = rest.substr(split + 1);
+                    command.passengerName = rest.substr(0, split);
+                    command.passengerName.erase(0, command.passengerName.find_first_not_of(" "));
+                    command.passengerName.erase(command.passengerName.find_last_not_of(" ") + 1);
+                }
+                try {
+                    command.amount = parseCents(amount);
+                    command.kind = Command::Deposit;
+                } catch (const invalid_argument&) {
+                    command.kind = Command::Invalid;
+                    command.argument = "Invalid amount.";
+                }
+                if (command.kind == Command::Deposit && command.passengerName.empty()) {
+                    command.kind = Command::Invalid;
+                    command.argument = "Usage: deposit <name> <amount>";
+                }
+            }
+            else if (word == "waitlist") {
+                command.kind = Command::Waitlist;
+                iss >> command.date >> command.flightNumber >> command.passengerName;
+                iss >> command.priority;
+            }
+            else if (word == "stats") {
+                command.kind = Command::Stats;
+                iss >> command.argument;
+            }
+            else if (word == "trace") {
+                command.kind = Command::Trace;
+                iss >> command.argument >> command.path;
+            }
+            else if (word == "bgsave") {
+                iss >> command.path;
+                command.kind = command.path.empty() ? Command::Invalid : Command::Bgsave;
+                if (command.path.empty()) command.argument = "Usage: bgsave <file>";
+            }
+            else if (word == "checkpoint") {
+                command.kind = Command::Checkpoint;
+            }
+            else if (word == "exit") {
+                command.kind = Command::Exit;
+            }
+            else if (word == "view") {
+                string viewType;
+                iss >> viewType;
+                if (viewType == "ID") {
+                    command.kind = Command::ViewID;
+                    iss >> command.ticketID;
+                } else if (viewType == "username") {
+                    command.kind = Command::ViewUsername;
+                    iss >> command.passengerName;
+                } else if (viewType == "flight") {
+                    command.kind = Command::ViewFlight;
+                    iss >> command.date >> command.flightNumber;
+                }
+            }
+            return command;
+        }
+
+        void execute(const Command& command, Program& program) const {
+            switch (command.kind) {
+                case Command::Book:
+                    program.bookTicket(command.flightNumber, command.date, command.seatNumber, command.seatLetter,
+                                       command.passengerName);
+                    break;
+                case Command::BookItinerary:
+                    program.bookItinerary(command.passengerName, command.legs);
+                    break;
+                case Command::Check:
+                    program.checkAvailability(command.flightNumber, command.date);
+                    break;
+                case Command::Return:
+                    program.returnTicket(command.ticketID);
+                    break;
+                case Command::Hold:
+                    program.holdSeat(command.flightNumber, command.date, command.seatNumber, command.seatLetter,
+                                     command.passengerName, command.ttlSeconds);
+                    break;
+                case Command::Confirm:
+                    program.confirmHold(command.holdID);
+                    break;
+                case Command::Deposit:
+                    program.deposit(command.passengerName, command.amount);
+                    break;
+                case Command::Waitlist:
+                    program.joinWaitlist(command.flightNumber, command.date, command.passengerName, command.priority);
+                    break;
+                case Command::Stats:
+                    program.showStats(command.argument);
+                    break;
+                case Command::ViewID:
+                    program.viewTicket(command.ticketID);
+                    break;
+                case Command::ViewUsername:
+                    program.viewByUsername(command.passengerName);
+                    break;
+                case Command::ViewFlight:
+                    program.viewByFlight(command.date, command.flightNumber);
+                    break;
+                case Command::Trace:
+                    trace(command);
+                    break;
+                case Command::Bgsave:
+                    program.backgroundSave(command.path);
+                    break;
+                case Command::Checkpoint:
+                    program.checkpoint();
+                    break;
+                case Command::Invalid:
+                    Console() << (command.argument.empty() ? "Seat is unavailable or invalid." : command.argument) << "\n";
+                    break;
+                case Command::None:
+                case Command::Exit:
+                    break;
+            }
+        }
+
+        void setRecorder(CommandRecorder* value) {
+            recorder = value;
+        }
+
+        // For modes that parse lines themselves instead of calling processInput
+        void record(const string& input) const {
+            if (recorder) recorder->record(input);
+        }
+
+    private:
+        CommandRecorder* recorder = nullptr;
+
+        // trace start | stop | dump <file>
+        static void trace(const Command& command) {
+            if (command.argument == "start") {
+                Tracer::start();
+                Console() << "Tracing started.\n";
+            } else if (command.argument == "stop") {
+                Tracer::stop();
+                Console() << "Tracing stopped.\n";
+            } else if (command.argument == "dump" && !command.path.empty()) {
+                size_t events, dropped;
+                string json = Tracer::exportJson(&events, &dropped);
+                try {
+                    File file(command.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    if (!writeFully(file, json.data(), json.size())) throw std::runtime_error("Short write");
+                    Console() << "Wrote " << events << " trace events to " << command.path << " (" << dropped << " dropped).\n";
+                } catch (const exception& e) {
+                    Console() << "Could not write trace: " << e.what() << "\n";
+                }
+            } else {
+                Console() << "Usage: trace start | stop | dump <file>\n";
+            }
+        }
+    };
+
+
+// Bounded single-producer/single-consumer queue
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity), mask(capacity - 1) {
+        if (capacity == 0 || (capacity & mask)) throw invalid_argument("SpscRing capacity must be a power of two");
+    }
+
+    bool tryPush(T& item) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) == slots.size()) return false;
+        slots[h & mask] = move(item);
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t == head.load(memory_order_acquire)) return false;
+        item = move(slots[t & mask]);
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return head.load(memory_order_acquire) - tail.load(memory_order_acquire);
+    }
+
+    // The producer is done; the consumer drains what is left
+    void close() {
+        closed.store(true, memory_order_release);
+    }
+
+    bool isClosed() const {
+        return closed.load(memory_order_acquire);
+    }
+
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) atomic<size_t> tail{0};
+    atomic<bool> closed{false};
+};
+
+// Where a pipeline stage spends its time. Starved is waiting on an empty
+// input queue, blocked is waiting on a full output queue.
+struct StageLoad {
+    atomic<uint64_t> items{0};
+    atomic<uint64_t> busyNanos{0};
+    atomic<uint64_t> starvedNanos{0};
+    atomic<uint64_t> blockedNanos{0};
+    atomic<uint64_t> queueDepthSum{0};  // input queue depth seen per item
+};
+
+// Batch mode (--pipeline): parsing, execution and rendering run on three
+// threads. The reader thread parses lines into Commands and hands them to
+// the executor over an SpscRing; the executor's output goes through its
+// console ring to ConsoleWriter, which formats and writes it. Output is
+// identical to the interactive loop, prompts included.
+class CommandPipeline {
+public:
+    static const size_t QueueSize = 1024;
+
+    CommandPipeline(Program& program, const InputReader& reader, const ConsoleWriter& console)
+        : program(program), reader(reader), console(console), commands(QueueSize) {
+        program.registerStats("pipeline", [this] { report(); });
+    }
+
+    // Parse stage, on the calling thread; returns once every command ran
+    void run(istream& in) {
+        started = chrono::steady_clock::now();
+        thread executor([this] { execute(); });
+        string input;
+        while (getline(in, input)) {
+            auto begin = chrono::steady_clock::now();
+            Command command;
+            {
+                TraceSpan span("parse");
+                reader.record(input);
+                command = reader.parse(input);
+            }
+            auto parsed = chrono::steady_clock::now();
+            parseLoad.busyNanos += nanosBetween(begin, parsed);
+            parseLoad.items++;
+
+            size_t spins = 0;
+            while (!commands.tryPush(command)) backOff(spins);
+            if (spins) parseLoad.blockedNanos += nanosBetween(parsed, chrono::steady_clock::now());
+            if (command.kind == Command::Exit) break;
+        }
+        commands.close();
+        executor.join();
+    }
+
+    void report() const {
+        double elapsed = max<uint64_t>(nanosBetween(started, chrono::steady_clock::now()), 1);
+        auto percent = [elapsed](uint64_t nanos) { return round(1000.0 * nanos / elapsed) / 10; };
+        uint64_t executed = executeLoad.items.load();
+        Console() << "Pipeline (" << commands.size() << " of " << QueueSize << " command slots in use):\n"
+                  << "  parse: " << parseLoad.items.load() << " commands, busy " << percent(parseLoad.busyNanos)
+                  << "%, blocked on a full queue " << percent(parseLoad.blockedNanos) << "%\n"
+                  << "  execute: " << executed << " commands, busy " << percent(executeLoad.busyNanos)
+                  << "%, starved " << percent(executeLoad.starvedNanos) << "%, avg queue depth "
+                  << (executed ? round(10.0 * executeLoad.queueDepthSum / executed) / 10 : 0.0) << "\n"
+                  << "  render: busy " << percent(console.busyNanos()) << "%\n";
+    }
+
+private:
+    Program& program;
+    const InputReader& reader;
+    const ConsoleWriter& console;
+    SpscRing<Command> commands;
+    StageLoad parseLoad;
+    StageLoad executeLoad;
+    chrono::steady_clock::time_point started;
+
+    static uint64_t nanosBetween(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+        return chrono::duration_cast<chrono::nanoseconds>(to - from).count();
+    }
+
+    // Spin briefly, then yield, then sleep so an idle stage stays cheap
+    static void backOff(size_t& spins) {
+        ++spins;
+        if (spins < 64) return;
+        if (spins < 1024) {
+            this_thread::yield();
+        } else {
+            this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+
+    void execute() {
+        Command command;
+        while (true) {
+            auto waitStart = chrono::steady_clock::now();
+            size_t spins = 0;
+            size_t depth = commands.size();
+            while (!commands.tryPop(command)) {
+                if (commands.isClosed() && commands.size() == 0) return;
+                backOff(spins);
             }
+            auto begin = chrono::steady_clock::now();
+            if (spins) executeLoad.starvedNanos += nanosBetween(waitStart, begin);
+
+            Console() << Console::literal(commandPrompt);
+            if (command.kind == Command::Exit) return;
+            {
+                TraceSpan span("execute");
+                reader.execute(command, program);
+            }
+            executeLoad.busyNanos += nanosBetween(begin, chrono::steady_clock::now());
+            executeLoad.queueDepthSum += depth;
+            executeLoad.items++;
+        }
+    }
+};
+
+// Batch mode (--parallel [threads]): commands for different flights do not
+// depend on each other, so runs of flight-scoped commands are grouped per
+// flight and the groups run on a work-stealing pool. A booking also debits
+// its passenger, so bookings by one passenger join one group even across
+// flights. Commands touching balances or tickets across flights (return,
+// confirm, deposit, itinerary, views by ID/user, stats, trace) are
+// barriers that run alone. Each command's output is captured and written
+// in input order, prompts included, so the output matches the sequential
+// loop; only ticket IDs, issued as bookings complete, can be numbered
+// differently.
+class ParallelBatch {
+public:
+    static const size_t ChunkSize = 64 * 1024;  // commands parsed ahead
+
+    ParallelBatch(Program& program, const InputReader& reader, size_t threadCount)
+        : program(program), reader(reader), workers(max<size_t>(threadCount, 1)) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].runner = thread([this, i] { work(i); });
+        }
+        program.registerStats("parallel", [this] { report(); });
+    }
+
+    ~ParallelBatch() {
+        {
+            lock_guard<mutex> guard(epochMutex);
+            stopping = true;
+        }
+        epochStarted.notify_all();
+        for (auto& worker : workers) worker.runner.join();
+    }
+
+    ParallelBatch(const ParallelBatch&) = delete;
+    ParallelBatch& operator=(const ParallelBatch&) = delete;
+
+    void run(istream& in) {
+        string input;
+        bool exiting = false;
+        while (!exiting) {
+            commands.clear();
+            while (commands.size() < ChunkSize && getline(in, input)) {
+                reader.record(input);
+                commands.push_back(reader.parse(input));
+                if (commands.back().kind == Command::Exit) break;
+            }
+            if (commands.empty()) break;
+            outputs.assign(commands.size(), string());
+            finished.reset(new atomic<bool>[commands.size()]);
+            for (size_t i = 0; i < commands.size(); ++i) finished[i].store(false, memory_order_relaxed);
+
+            size_t i = 0;
+            while (i < commands.size()) {
+                if (flightOf(commands[i]).empty() && isBarrier(commands[i])) {
+                    Console() << Console::literal(commandPrompt);
+                    if (commands[i].kind == Command::Exit) {
+                        exiting = true;
+                        break;
+                    }
+                    reader.execute(commands[i], program);
+                    ++barriers;
+                    ++i;
+                    continue;
+                }
+                size_t end = i;
+                while (end < commands.size() && !(flightOf(commands[end]).empty() && isBarrier(commands[end]))) ++end;
+                runEpoch(i, end);
+                i = end;
+            }
+        }
+    }
+
+    void report() const {
+        Console() << "Parallel batch: " << workers.size() << " worker(s), " << executed.load() << " commands in "
+                  << epochs.load() << " parallel run(s) of " << groupsRun.load() << " flight group(s), "
+                  << barriers.load() << " barrier command(s), " << steals.load() << " steal(s)\n";
+    }
+
+private:
+    struct Worker {
+        thread runner;
+        mutex lock;
+        deque<size_t> groups;  // indices into ParallelBatch::groups
+    };
+
+    Program& program;
+    const InputReader& reader;
+    vector<Worker> workers;
+
+    vector<Command> commands;
+    vector<vector<size_t>> groups;          // command indices per flight, in input order
+    vector<string> outputs;                 // captured output per command
+    unique_ptr<atomic<bool>[]> finished;    // per command, set once its output is complete
+    atomic<size_t> groupsFinished{0};
+
+    mutex epochMutex;
+    condition_variable epochStarted;
+    uint64_t epoch = 0;
+    bool stopping = false;
+
+    atomic<uint64_t> executed{0};
+    atomic<uint64_t> epochs{0};
+    atomic<uint64_t> groupsRun{0};
+    atomic<uint64_t> barriers{0};
+    atomic<uint64_t> steals{0};
+
+    static string flightOf(const Command& command) {
+        switch (command.kind) {
+            case Command::Book:
+            case Command::Check:
+            case Command::Hold:
+            case Command::Waitlist:
+            case Command::ViewFlight:
+                return flightKey(command.date, command.flightNumber);
+            default:
+                return "";
         }
+    }
+
+    // The balance a command debits, if any
+    static string passengerOf(const Command& command) {
+        return command.kind == Command::Book ? command.passengerName : "";
+    }
+
+    // Commands that neither name a flight nor touch shared state (blank or
+    // malformed lines) can go anywhere; everything else without a flight
+    // key is a barrier
+    static bool isBarrier(const Command& command) {
+        return command.kind != Command::None && command.kind != Command::Invalid;
+    }
+
+    // Runs commands [begin, end) grouped by flight and writes their output.
+    // A booking joins its flight's group with its passenger's, so a
+    // passenger's bookings keep their input order.
+    void runEpoch(size_t begin, size_t end) {
+        map<string, size_t> keyIds;  // flight keys and passenger names, each its own namespace
+        vector<size_t> parent;
+        auto idOf = [&](const string& key) {
+            auto inserted = keyIds.emplace(key, parent.size());
+            if (inserted.second) parent.push_back(parent.size());
+            return inserted.first->second;
+        };
+        auto root = [&](size_t id) {
+            while (parent[id] != id) id = parent[id] = parent[parent[id]];
+            return id;
+        };
+        vector<size_t> keyOfCommand(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            size_t flight = idOf("F" + flightOf(commands[i]));
+            string passenger = passengerOf(commands[i]);
+            if (!passenger.empty()) parent[root(idOf("P" + passenger))] = root(flight);
+            keyOfCommand[i - begin] = flight;
+        }
+        map<size_t, size_t> groupOf;  // root key -> group
+        groups.clear();
+        for (size_t i = begin; i < end; ++i) {
+            auto inserted = groupOf.emplace(root(keyOfCommand[i - begin]), groups.size());
+            if (inserted.second) groups.emplace_back();
+            groups[inserted.first->second].push_back(i);
+        }
+        groupsFinished = 0;
 
+        for (size_t g = 0; g < groups.size(); ++g) {
+            Worker& worker = workers[g % workers.size()];
+            lock_guard<mutex> guard(worker.lock);
+            worker.groups.push_back(g);
+        }
+        {
+            lock_guard<mutex> guard(epochMutex);
+            ++epoch;
+        }
+        epochStarted.notify_all();
+
+        // Emit outputs in input order as the prefix completes
+        for (size_t next = begin; next < end; ++next) {
+            while (!finished[next].load(memory_order_acquire)) this_thread::sleep_for(chrono::microseconds(100));
+            Console() << Console::literal(commandPrompt) << outputs[next];
+            string().swap(outputs[next]);
+        }
+        // Workers may still be leaving their last group
+        while (groupsFinished.load(memory_order_acquire) < groups.size()) this_thread::yield();
+
+        executed += end - begin;
+        groupsRun += groups.size();
+        ++epochs;
+    }
+
+    // Own queue from the front, other queues from the back
+    bool takeGroup(size_t self, size_t& group) {
+        {
+            Worker& own = workers[self];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.groups.empty()) {
+                group = own.groups.front();
+                own.groups.pop_front();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < workers.size(); ++k) {
+            Worker& victim = workers[(self + k) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.groups.empty()) {
+                group = victim.groups.back();
+                victim.groups.pop_back();
+                ++steals;
+                return true;
+            }
+        }
+        return false;
+    }
 
-        if (ticketOwner) {
-            // Find the corresponding airplane and return the seat
-            for (auto& airplane : airplanes) {
-                if (airplane.flightNumber == foundTicket.flightNumber && airplane.date == foundTicket.flightDate) {
-                    airplane.returnSeat(foundTicket.seat.number, foundTicket.seat.letter);  // Return the seat in the airplane
-                    ticketOwner->returnTicket(ticketID);           // Remove the ticket from the passenger
-                    ticketOwner->refundMoney(foundTicket.seat.price);   // Refund the ticket price to the passenger
-                    cout << "Ticket returned successfully. Refund issued for $" << foundTicket.seat.price << endl;
-                    return;
+    void work(size_t self) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(epochMutex);
+                epochStarted.wait(guard, [&] { return stopping || epoch != seen; });
+                if (stopping) return;
+                seen = epoch;
+            }
+            size_t group;
+            while (takeGroup(self, group)) {
+                for (size_t index : groups[group]) {
+                    ConsoleQueues::captureInto(&outputs[index]);
+                    {
+                        TraceSpan span("execute");
+                        reader.execute(commands[index], program);
+                    }
+                    ConsoleQueues::captureInto(nullptr);
+                    finished[index].store(true, memory_order_release);
                 }
+                groupsFinished.fetch_add(1, memory_order_release);
             }
-        } else {
-            cout << "Ticket not found.\n";
         }
     }
+};
 
-    // View all tickets for a passenger
-    void viewBookedTickets(const string& passengerName) {
-        Passenger* passenger = findPassenger(passengerName);
-        if (passenger) {
-            passenger->showTickets();
-        } else {
-            cout << "Passenger not found!\n";
+static sockaddr_in loopbackAddress(int port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(uint16_t(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+// Splits a byte stream into lines
+class LineReader {
+public:
+    explicit LineReader(File& connection) : connection(connection) {}
+
+    bool next(string& line) {
+        while (true) {
+            size_t end = pending.find('\n', scanned);
+            if (end != string::npos) {
+                line.assign(pending, 0, end);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                pending.erase(0, end + 1);
+                scanned = 0;
+                return true;
+            }
+            scanned = pending.size();
+            if (!fill()) return false;
         }
     }
 
-    void viewTicket(int ticketID) {
-        for (const auto& ticket : tickets) {
-            if (ticket.ticketID == ticketID) {
-                ticket.viewTicket();
-                return;
+    // Reads up to a line holding a single "." and returns what preceded it
+    bool until(const string& terminator, string& text) {
+        while (true) {
+            size_t end = pending.compare(0, terminator.size(), terminator) == 0
+                ? 0 : pending.find("\n" + terminator, scanned);
+            if (end != string::npos) {
+                size_t textSize = end == 0 ? 0 : end + 1;
+                text.assign(pending, 0, textSize);
+                pending.erase(0, textSize + terminator.size());
+                scanned = 0;
+                return true;
             }
+            scanned = pending.size() > terminator.size() ? pending.size() - terminator.size() : 0;
+            if (!fill()) return false;
         }
-        cout << "Ticket ID not found.\n";
     }
 
-    void viewByUsername(const string& username) {
-        Passenger* passenger = findPassenger(username);
-        if (passenger) {
-            passenger->showTickets();
-        } else {
-            cout << "Passenger not found.\n";
+private:
+    File& connection;
+    string pending;
+    size_t scanned = 0;
+
+    bool fill() {
+        char buffer[16384];
+        ssize_t bytesRead;
+        do {
+            bytesRead = connection.read(buffer, sizeof(buffer));
+        } while (bytesRead < 0 && errno == EINTR);
+        if (bytesRead <= 0) return false;
+        pending.append(buffer, bytesRead);
+        return true;
+    }
+};
+
+// `--serve <port>`: runs commands from loopback TCP clients, one thread per
+// connection. Each request is one command line; the reply is the command's
+// output followed by a line holding a single "." (so `nc` works as a
+// client). "quit" closes the connection.
+class CommandServer {
+public:
+    static constexpr const char* Terminator = ".\n";
+
+    CommandServer(Program& program, InputReader& reader, int port)
+        : program(program), reader(reader), stopping(false) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1) throw std::runtime_error("Failed to create server socket");
+        listener = File(fd);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address = loopbackAddress(port);
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 || listen(fd, 1024) == -1) {
+            throw std::runtime_error("Failed to listen on port " + to_string(port));
         }
+        acceptor = thread([this] { acceptLoop(); });
+        program.registerStats("server", [this] { report(); });
     }
 
-    void viewByFlight(const string& date, const string& flightNumber) {
-        for (const auto& airplane : airplanes) {
-            if (airplane.flightNumber == flightNumber && airplane.date == date) {
-                cout << "Available tickets for flight " << flightNumber << " on " << date << ":\n";
-                airplane.displayAvailableSeats();
+    ~CommandServer() {
+        stopping = true;
+        shutdown(listener.getFileDescriptor(), SHUT_RDWR);
+        acceptor.join();
+        {
+            lock_guard<mutex> guard(clientsMutex);
+            for (auto& client : clients) shutdown(client.second->getFileDescriptor(), SHUT_RDWR);
+        }
+        for (auto& handler : handlers) handler.join();
+    }
+
+    CommandServer(const CommandServer&) = delete;
+    CommandServer& operator=(const CommandServer&) = delete;
+
+private:
+    Program& program;
+    InputReader& reader;
+    File listener{-1};
+    atomic<bool> stopping;
+    thread acceptor;
+    vector<thread> handlers;
+    mutex clientsMutex;
+    map<int, shared_ptr<File>> clients;
+    int nextClientId = 1;
+    atomic<uint64_t> accepted{0};
+    atomic<uint64_t> served{0};
+
+    void acceptLoop() {
+        while (!stopping) {
+            int fd = accept(listener.getFileDescriptor(), nullptr, nullptr);
+            if (fd == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
                 return;
             }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            lock_guard<mutex> guard(clientsMutex);
+            int id = nextClientId++;
+            clients[id] = make_shared<File>(fd);
+            ++accepted;
+            handlers.emplace_back([this, id] { serve(id); });
+        }
+    }
+
+    void serve(int id) {
+        shared_ptr<File> connection;
+        {
+            lock_guard<mutex> guard(clientsMutex);
+            connection = clients[id];
+        }
+        LineReader lines(*connection);
+        string line, reply;
+        while (lines.next(line) && line != "quit") {
+            reply.clear();
+            ConsoleQueues::captureInto(&reply);
+            reader.processInput(line, program);
+            ConsoleQueues::captureInto(nullptr);
+            reply += Terminator;
+            if (!writeFully(*connection, reply.data(), reply.size())) break;
+            ++served;
+        }
+        lock_guard<mutex> guard(clientsMutex);
+        clients.erase(id);
+    }
+
+    void report() {
+        size_t open;
+        {
+            lock_guard<mutex> guard(clientsMutex);
+            open = clients.size();
         }
-        cout << "Flight not found.\n";
+        Console() << "Server: " << open << " open connection(s), " << accepted.load() << " accepted, "
+                  << served.load() << " commands served\n";
     }
 };
 
-class InputReader {
-    public:
-        void processInput(const string& input, Program& program) {
-            istringstream iss(input);
-            string command;
-            iss >> command;
+// Client side of the CommandServer protocol
+class ServerConnection {
+public:
+    explicit ServerConnection(int port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1) throw std::runtime_error("Failed to create socket");
+        connection = File(fd);
+        sockaddr_in address = loopbackAddress(port);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+            throw std::runtime_error("Failed to connect to port " + to_string(port));
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // Sends one command and waits for its output
+    bool request(const string& line, string& reply) {
+        string out = line + "\n";
+        return writeFully(connection, out.data(), out.size()) && lines.until(CommandServer::Terminator, reply);
+    }
+
+private:
+    File connection{-1};
+    LineReader lines{connection};
+};
 
-            if (command == "book") {
-                string date, flightNumber, seatStr, passengerName;
-                iss >> date >> flightNumber >> seatStr;
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// 128 are exact, above that each power of two is split into 64 buckets, so
+// any recorded value is within about 1.6% of the truth.
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts(bucketFor(UINT64_MAX) + 1) {}
 
-                string seatID = seatStr;
+    void record(uint64_t value) {
+        counts[bucketFor(value)]++;
+        total++;
+        sum += value;
+        maximum = std::max(maximum, value);
+    }
 
-                size_t pos = seatStr.find_first_not_of("0123456789");
-                string seatNumber = seatStr.substr(0, pos);
-                char seatLetter = seatStr[pos];
+    // Also records the samples a stalled closed-loop client never sent
+    // (coordinated omission), as HdrHistogram's recordCorrectedValue does
+    void recordCorrected(uint64_t value, uint64_t expectedInterval) {
+        record(value);
+        if (expectedInterval == 0) return;
+        for (uint64_t missing = value - expectedInterval; value > expectedInterval && missing >= expectedInterval;
+             missing -= expectedInterval) {
+            record(missing);
+        }
+    }
 
-                // Assuming passenger name is the remaining part of the string
-                getline(iss, passengerName);
-                passengerName.erase(0, passengerName.find_first_not_of(" "));
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts.size(); ++i) counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        maximum = std::max(maximum, other.maximum);
+    }
 
-                program.bookTicket(flightNumber, date, seatNumber, seatLetter, passengerName);
-            }
-            else if (command == "check") {
-                string date, flightNumber;
-                iss >> date >> flightNumber;
-                program.checkAvailability(flightNumber, date);
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maximum; }
+    double mean() const { return total ? double(sum) / total : 0.0; }
+
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = uint64_t(ceil(p / 100.0 * total));
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(highestInBucket(i), maximum);
+        }
+        return maximum;
+    }
+
+    // Percentile distribution in the .hgrm text layout, values scaled by
+    // `unit` (1000 prints nanosecond samples as microseconds)
+    string distribution(double unit) const {
+        static const double points[] = {0, 10, 20, 30, 40, 50, 60, 70, 75, 80, 85, 90, 95, 97.5, 99,
+                                        99.5, 99.9, 99.95, 99.99, 99.999, 100};
+        string out;
+        char line[128];
+        snprintf(line, sizeof(line), "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+        out += line;
+        for (double p : points) {
+            uint64_t value = percentile(p);
+            uint64_t below = 0;
+            for (size_t i = 0; i < counts.size() && lowestInBucket(i) <= value; ++i) below += counts[i];
+            if (p < 100) {
+                snprintf(line, sizeof(line), "%12.3f %14.6f %10llu %14.2f\n", value / unit, p / 100.0,
+                         (unsigned long long)below, 1.0 / (1.0 - p / 100.0));
+            } else {
+                snprintf(line, sizeof(line), "%12.3f %14.6f %10llu\n", value / unit, 1.0, (unsigned long long)below);
             }
-            else if (command == "return") {
-                int ticketID;
-                iss >> ticketID;
-                program.returnTicket(ticketID);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "#[Mean    = %12.3f, Max        = %12.3f]\n#[Total count    = %12llu]\n",
+                 mean() / unit, maximum / unit, (unsigned long long)total);
+        out += line;
+        return out;
+    }
+
+private:
+    static const int SubBucketBits = 7;
+    static const uint64_t HalfBucket = 1 << (SubBucketBits - 1);
+
+    vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t maximum = 0;
+
+    static size_t bucketFor(uint64_t value) {
+        int msb = value ? 63 - __builtin_clzll(value) : 0;
+        int shift = std::max(0, msb - (SubBucketBits - 1));
+        return shift * HalfBucket + (value >> shift);
+    }
+
+    static uint64_t lowestInBucket(size_t bucket) {
+        if (bucket < 2 * HalfBucket) return bucket;
+        size_t shift = bucket / HalfBucket - 1;
+        return (bucket - shift * HalfBucket) << shift;
+    }
+
+    static uint64_t highestInBucket(size_t bucket) {
+        if (bucket < 2 * HalfBucket) return bucket;
+        size_t shift = bucket / HalfBucket - 1;
+        return lowestInBucket(bucket) + (uint64_t(1) << shift) - 1;
+    }
+};
+
+// Picks index i in [0, n) with probability proportional to 1 / (i + 1)^s
+class ZipfSampler {
+public:
+    ZipfSampler(size_t n, double s) : cdf(n) {
+        double total = 0;
+        for (size_t i = 0; i < n; ++i) cdf[i] = total += 1.0 / pow(double(i + 1), s);
+        for (double& c : cdf) c /= total;
+    }
+
+    size_t operator()(mt19937_64& rng) const {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return std::min(size_t(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), cdf.size() - 1);
+    }
+
+private:
+    vector<double> cdf;
+};
+
+// `--loadgen <port>`: closed-loop load against a --serve instance. Every
+// connection is a passenger sending a weighted mix of book / check /
+// return / view on Zipf-distributed flights. With a target rate each
+// connection follows a fixed send schedule and latency is measured from
+// the scheduled send time, so server stalls are not hidden (coordinated
+// omission). Without a rate, the connection's mean service time is used as
+// the expected interval to correct the histogram instead.
+class LoadGenerator {
+public:
+    struct Options {
+        int port = 0;
+        size_t connections = 100;
+        double seconds = 10;
+        double rate = 0;      // total requests/s, 0 = as fast as possible
+        double zipf = 1.0;
+        bool curve = false;   // sweep rates up to and past the measured peak
+        string hdrPath;       // where to write the percentile distributions
+        map<string, double> mix = {{"book", 40}, {"check", 40}, {"return", 10}, {"view", 10}};
+    };
+
+    LoadGenerator(const vector<FlightSpec>& flights, const Options& options)
+        : flights(flights), options(options), zipf(flights.size(), options.zipf) {}
+
+    // "book=40,check=40,return=10,view=10"
+    static map<string, double> parseMix(const string& text) {
+        map<string, double> mix;
+        istringstream in(text);
+        string item;
+        while (getline(in, item, ',')) {
+            size_t eq = item.find('=');
+            if (eq == string::npos) throw invalid_argument("Bad mix entry " + item);
+            string op = item.substr(0, eq);
+            if (op != "book" && op != "check" && op != "return" && op != "view") {
+                throw invalid_argument("Unknown operation " + op);
             }
-            else if (command == "view") {
-                string viewType;
-                iss >> viewType;
-                if (viewType == "ID") {
-                    int ticketID;
-                    iss >> ticketID;
-                    program.viewTicket(ticketID);
-                } else if (viewType == "username") {
-                    string username;
-                    iss >> username;
-                    program.viewByUsername(username);
-                } else if (viewType == "flight") {
-                    string date, flightNumber;
-                    iss >> date >> flightNumber;
-                    program.viewByFlight(date, flightNumber);
+            mix[op] = stod(item.substr(eq + 1));
+        }
+        return mix;
+    }
+
+    bool run() {
+        if (flights.empty()) {
+            Console() << "No flights configured for the load generator.\n";
+            return false;
+        }
+        try {
+            for (size_t i = 0; i < options.connections; ++i) {
+                clients.emplace_back(new Client(options.port, i));
+                string reply;
+                if (!clients.back()->connection.request("deposit " + clients.back()->passenger + " 100000000", reply)) {
+                    throw std::runtime_error("Server closed the connection");
                 }
             }
+        } catch (const exception& e) {
+            Console() << "Load generator: " << e.what() << "\n";
+            return false;
+        }
+
+        vector<pair<string, Phase>> phases;
+        if (!options.curve) {
+            phases.emplace_back("run", runPhase(options.rate));
+            printPhase(phases.back().second);
+            Console() << phases.back().second.latency.distribution(1000.0);
+        } else {
+            Phase peak = runPhase(0);
+            Console() << "Peak (unthrottled): " << round(peak.achieved) << " requests/s\n";
+            phases.emplace_back("peak", move(peak));
+            Console() << "  target/s   achieved/s    p50 us    p90 us    p99 us  p99.9 us    max us  errors\n";
+            for (double fraction : {0.1, 0.25, 0.5, 0.75, 0.9, 1.0, 1.1, 1.25}) {
+                double rate = fraction * phases.front().second.achieved;
+                phases.emplace_back(to_string(int(fraction * 100)) + "% of peak", runPhase(rate));
+                printRow(phases.back().second);
+            }
         }
+        if (!options.hdrPath.empty()) writeDistributions(phases);
+        return true;
+    }
+
+private:
+    struct Client {
+        ServerConnection connection;
+        string passenger;
+        mt19937_64 rng;
+        vector<int> tickets;
+
+        Client(int port, size_t index)
+            : connection(port), passenger("load" + to_string(index)), rng(0x9e3779b97f4a7c15ULL * (index + 1)) {}
+    };
+
+    struct Phase {
+        double target = 0;
+        double achieved = 0;
+        uint64_t errors = 0;
+        LatencyHistogram latency;  // nanoseconds, coordinated-omission corrected
     };
 
+    vector<FlightSpec> flights;
+    Options options;
+    ZipfSampler zipf;
+    vector<unique_ptr<Client>> clients;
+
+    string nextCommand(Client& client) {
+        double total = 0;
+        for (const auto& entry : options.mix) total += entry.second;
+        double pick = uniform_real_distribution<double>(0.0, total)(client.rng);
+        string op = options.mix.rbegin()->first;
+        for (const auto& entry : options.mix) {
+            if (pick < entry.second) {
+                op = entry.first;
+                break;
+            }
+            pick -= entry.second;
+        }
+
+        const FlightSpec& flight = flights[zipf(client.rng)];
+        if (op == "return" && !client.tickets.empty()) {
+            size_t i = uniform_int_distribution<size_t>(0, client.tickets.size() - 1)(client.rng);
+            int ticketID = client.tickets[i];
+            client.tickets[i] = client.tickets.back();
+            client.tickets.pop_back();
+            return "return " + to_string(ticketID);
+        }
+        if (op == "book" && !flight.ranges.empty()) {
+            const PriceRange& range = flight.ranges[uniform_int_distribution<size_t>(0, flight.ranges.size() - 1)(client.rng)];
+            int row = uniform_int_distribution<int>(range.rowStart, range.rowEnd)(client.rng);
+            char letter = char('A' + uniform_int_distribution<int>(0, max(flight.seatsPerRow, 1) - 1)(client.rng));
+            return "book " + flight.date + " " + flight.flightNumber + " " + to_string(row) + letter + " " + client.passenger;
+        }
+        if (op == "view") return "view username " + client.passenger;
+        return "check " + flight.date + " " + flight.flightNumber;
+    }
+
+    Phase runPhase(double rate) {
+        Phase phase;
+        phase.target = rate;
+        vector<LatencyHistogram> histograms(clients.size());
+        vector<uint64_t> completed(clients.size()), errors(clients.size());
+        auto start = chrono::steady_clock::now() + chrono::milliseconds(50);
+        auto end = start + chrono::nanoseconds(uint64_t(options.seconds * 1e9));
+        // Each connection sends every `interval`, staggered across the first one
+        chrono::nanoseconds interval(rate > 0 ? uint64_t(clients.size() * 1e9 / rate) : 0);
+
+        vector<thread> threads;
+        for (size_t i = 0; i < clients.size(); ++i) {
+            threads.emplace_back([&, i] {
+                Client& client = *clients[i];
+                string reply;
+                auto due = start + interval * i / clients.size();
+                uint64_t serviceTotal = 0;
+                while (true) {
+                    if (rate > 0) {
+                        if (due >= end) break;
+                        this_thread::sleep_until(due);
+                    } else {
+                        due = chrono::steady_clock::now();
+                        if (due >= end) break;
+                    }
+                    auto sent = chrono::steady_clock::now();
+                    if (!client.connection.request(nextCommand(client), reply)) {
+                        errors[i]++;
+                        break;
+                    }
+                    auto received = chrono::steady_clock::now();
+                    size_t id = reply.find("Ticket ID: ");
+                    if (id != string::npos && reply.compare(0, 26, "Ticket booked successfully") == 0) {
+                        client.tickets.push_back(atoi(reply.c_str() + id + 11));
+                    }
+                    uint64_t service = chrono::duration_cast<chrono::nanoseconds>(received - sent).count();
+                    serviceTotal += service;
+                    completed[i]++;
+                    if (rate > 0) {
+                        histograms[i].record(chrono::duration_cast<chrono::nanoseconds>(received - due).count());
+                        due += interval;
+                    } else {
+                        histograms[i].recordCorrected(service, serviceTotal / completed[i]);
+                    }
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < clients.size(); ++i) {
+            phase.latency.merge(histograms[i]);
+            total += completed[i];
+            phase.errors += errors[i];
+        }
+        phase.achieved = total / options.seconds;
+        return phase;
+    }
+
+    void printPhase(const Phase& phase) {
+        Console() << "Load: " << clients.size() << " connection(s) for " << options.seconds << " s, target "
+                  << (phase.target > 0 ? to_string(int64_t(phase.target)) + " requests/s" : string("unthrottled"))
+                  << ", achieved " << round(phase.achieved) << " requests/s, " << phase.errors << " error(s)\n";
+    }
+
+    void printRow(const Phase& phase) {
+        const LatencyHistogram& h = phase.latency;
+        char row[160];
+        snprintf(row, sizeof(row), "%10.0f %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f %7llu\n", phase.target, phase.achieved,
+                 h.percentile(50) / 1000.0, h.percentile(90) / 1000.0, h.percentile(99) / 1000.0,
+                 h.percentile(99.9) / 1000.0, h.max() / 1000.0, (unsigned long long)phase.errors);
+        Console() << string(row);
+    }
+
+    void writeDistributions(const vector<pair<string, Phase>>& phases) {
+        string text;
+        for (const auto& phase : phases) {
+            text += "# " + phase.first + ": target " + to_string(int64_t(phase.second.target)) + "/s, achieved " +
+                    to_string(int64_t(phase.second.achieved)) + "/s, values in microseconds\n";
+            text += phase.second.latency.distribution(1000.0) + "\n";
+        }
+        try {
+            File file(options.hdrPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (!writeFully(file, text.data(), text.size())) throw std::runtime_error("Short write");
+            Console() << "Wrote latency distributions to " << options.hdrPath << "\n";
+        } catch (const exception& e) {
+            Console() << "Could not write " << options.hdrPath << ": " << e.what() << "\n";
+        }
+    }
+};
+
+// `--bench-contention [max threads]`: many bookers against 64 flights, for
+// every thread count (powers of two up to the maximum) and every skew from
+// uniform to a single hot flight. Each booker books a random seat through
+// Program::bookTicket and returns its oldest ticket once it holds a few,
+// so flights never sell out. Reports successful bookings/s, time spent
+// waiting on the airplane and ledger locks (as a share of booker time),
+// and Jain's fairness index over per-thread bookings (1 = perfectly fair).
+class ContentionBenchmark {
+public:
+    static const int FlightCount = 64;
+    static const int RowsPerFlight = 200;
+    static const size_t TicketsKept = 4;
+
+    ContentionBenchmark(size_t maxThreads, double seconds) : maxThreads(max<size_t>(maxThreads, 1)), seconds(seconds) {
+        for (int i = 0; i < FlightCount; ++i) {
+            specs.push_back(FlightSpec{"01.06.2025", "B" + to_string(i), 6, {{1, RowsPerFlight, 10000}}});
+        }
+    }
+
+    void run() {
+        Console() << "Contention benchmark: " << FlightCount << " flights x " << RowsPerFlight * 6 << " seats, "
+                  << seconds << " s per cell\n"
+                  << "threads  skew        bookings/s  failed/s  seat wait  ledger wait  contended/s  fairness\n";
+        // Zipf exponents; infinity puts every booking on one flight
+        const vector<pair<string, double>> skews = {{"uniform", 0.0}, {"zipf-0.8", 0.8}, {"zipf-1.2", 1.2},
+                                                    {"zipf-2.0", 2.0}, {"single", INFINITY}};
+        for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+            for (const auto& skew : skews) runCell(threads, skew.first, skew.second);
+        }
+    }
+
+private:
+    size_t maxThreads;
+    double seconds;
+    vector<FlightSpec> specs;
+
+    void runCell(size_t threads, const string& skewName, double exponent) {
+        Program program(specs);
+        for (size_t t = 0; t < threads; ++t) {
+            string discarded;
+            ConsoleQueues::captureInto(&discarded);
+            program.deposit("bench" + to_string(t), Cents(1) << 50);
+            ConsoleQueues::captureInto(nullptr);
+        }
+        ZipfSampler zipf(FlightCount, std::isinf(exponent) ? 0.0 : exponent);
+
+        vector<uint64_t> booked(threads), failed(threads);
+        atomic<bool> go{false};
+        atomic<bool> stop{false};
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                mt19937_64 rng(t + 1);
+                string passenger = "bench" + to_string(t);
+                string output;
+                deque<int> tickets;
+                ConsoleQueues::captureInto(&output);
+                while (!go.load(memory_order_acquire)) this_thread::yield();
+                while (!stop.load(memory_order_relaxed)) {
+                    const FlightSpec& flight = specs[std::isinf(exponent) ? 0 : zipf(rng)];
+                    int row = uniform_int_distribution<int>(1, RowsPerFlight)(rng);
+                    char letter = char('A' + uniform_int_distribution<int>(0, 5)(rng));
+                    output.clear();
+                    program.bookTicket(flight.flightNumber, flight.date, to_string(row), letter, passenger);
+                    size_t id = output.find("Ticket ID: ");
+                    if (id == string::npos) {
+                        failed[t]++;
+                        continue;
+                    }
+                    booked[t]++;
+                    tickets.push_back(atoi(output.c_str() + id + 11));
+                    if (tickets.size() > TicketsKept) {
+                        program.returnTicket(tickets.front());
+                        tickets.pop_front();
+                    }
+                }
+                ConsoleQueues::captureInto(nullptr);
+            });
+        }
+        auto begin = chrono::steady_clock::now();
+        go = true;
+        this_thread::sleep_for(chrono::nanoseconds(uint64_t(seconds * 1e9)));
+        stop = true;
+        for (auto& worker : workers) worker.join();
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+        uint64_t totalBooked = 0, totalFailed = 0;
+        double squares = 0;
+        for (size_t t = 0; t < threads; ++t) {
+            totalBooked += booked[t];
+            totalFailed += failed[t];
+            squares += double(booked[t]) * booked[t];
+        }
+        double fairness = squares > 0 ? double(totalBooked) * totalBooked / (threads * squares) : 0.0;
+        LockContention seats = program.seatLockContention();
+        LockContention ledger = program.ledgerLockContention();
+        double bookerNanos = elapsed * 1e9 * threads;
+
+        char row[160];
+        snprintf(row, sizeof(row), "%7zu  %-10s %11.0f %9.0f %9.1f%% %11.1f%% %12.0f %9.3f\n", threads, skewName.c_str(),
+                 totalBooked / elapsed, totalFailed / elapsed, 100.0 * seats.waitNanos / bookerNanos,
+                 100.0 * ledger.waitNanos / bookerNanos, (seats.contended + ledger.contended) / elapsed, fairness);
+        Console() << string(row);
+    }
+};
+
+// `--replay <file> [--speed N|max] [--target <port>]`: feeds a recorded
+// trace through InputReader::processInput, or to a --serve instance, keeping the recorded gaps divided by the speed
+// factor (or none at max). Command output is discarded. Service time is
+// measured per command; response time is measured from when the command
+// was due, so falling behind shows up in it.
+class TraceReplayer {
+public:
+    TraceReplayer(Program& program, InputReader& reader, ServerConnection* target = nullptr)
+        : program(program), reader(reader), target(target) {}
+
+    // `speed` 0 replays as fast as possible
+    bool run(const string& path, double speed) {
+        string data;
+        try {
+            File file(path.c_str(), O_RDONLY);
+            char chunk[65536];
+            ssize_t bytesRead;
+            while ((bytesRead = file.read(chunk, sizeof(chunk))) > 0) data.append(chunk, bytesRead);
+        } catch (const exception& e) {
+            Console() << "Could not open trace " << path << ": " << e.what() << "\n";
+            return false;
+        }
+        const string magic = CommandRecorder::Magic;
+        if (data.compare(0, magic.size(), magic) != 0) {
+            Console() << path << " is not a command trace.\n";
+            return false;
+        }
+
+        BinaryReader in(data);
+        string header(magic.size(), '\0');
+        in.raw(&header[0], header.size());
+        vector<uint64_t> service, response;
+        string discarded;
+        uint64_t offset = 0;
+        auto start = chrono::steady_clock::now();
+        try {
+            while (!in.atEnd()) {
+                offset += in.varint();
+                string line(in.varint(), '\0');
+                in.raw(&line[0], line.size());
+
+                auto due = speed > 0 ? start + chrono::nanoseconds(uint64_t(offset / speed)) : start;
+                if (speed > 0) this_thread::sleep_until(due);
+                auto begin = chrono::steady_clock::now();
+                if (speed <= 0) due = begin;  // nothing is late at max speed
+                if (target) {
+                    if (!target->request(line, discarded)) throw std::runtime_error("Server closed the connection");
+                } else {
+                    ConsoleQueues::captureInto(&discarded);
+                    reader.processInput(line, program);
+                    ConsoleQueues::captureInto(nullptr);
+                }
+                discarded.clear();
+                auto end = chrono::steady_clock::now();
+
+                service.push_back(chrono::duration_cast<chrono::nanoseconds>(end - begin).count());
+                response.push_back(chrono::duration_cast<chrono::nanoseconds>(end - due).count());
+            }
+        } catch (const exception& e) {
+            ConsoleQueues::captureInto(nullptr);
+            Console() << "Trace " << path << " is damaged after " << service.size() << " commands: " << e.what() << "\n";
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        {
+            Console line;
+            line << "Replayed " << service.size() << " commands in " << seconds << " s ("
+                 << (seconds > 0 ? round(service.size() / seconds) : 0.0) << " commands/s) at ";
+            if (speed > 0) {
+                line << speed << "x speed\n";
+            } else {
+                line << "max speed\n";
+            }
+        }
+        printPercentiles("service time", service);
+        printPercentiles("response time", response);
+        return true;
+    }
+
+private:
+    Program& program;
+    InputReader& reader;
+    ServerConnection* target;
+
+    static void printPercentiles(const char* name, vector<uint64_t>& nanos) {
+        if (nanos.empty()) return;
+        sort(nanos.begin(), nanos.end());
+        auto at = [&](double fraction) {
+            return nanos[min(nanos.size() - 1, size_t(fraction * nanos.size()))] / 1000.0;
+        };
+        Console() << "  " << name << " (us): p50 " << at(0.50) << ", p90 " << at(0.90) << ", p99 " << at(0.99)
+                  << ", p99.9 " << at(0.999) << ", max " << nanos.back() / 1000.0 << "\n";
+    }
+};
+
+// Takes a checkpoint every `interval` seconds until destroyed
+class Checkpointer {
+public:
+    Checkpointer(Program& program, double interval) : program(program), interval(interval) {
+        worker = thread([this] { run(); });
+    }
+
+    ~Checkpointer() {
+        {
+            lock_guard<mutex> guard(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+private:
+    Program& program;
+    double interval;
+    mutex stateMutex;
+    condition_variable wake;
+    bool stopping = false;
+    thread worker;
+
+    void run() {
+        unique_lock<mutex> lock(stateMutex);
+        while (!wake.wait_for(lock, chrono::duration<double>(interval), [this] { return stopping; })) {
+            lock.unlock();
+            program.checkpoint(false);
+            lock.lock();
+        }
+    }
+};
+
+// Everything below is only for the command-line entry point; tests
+// include this file with AIRFLIGHT_NO_MAIN and supply their own main
+#ifndef AIRFLIGHT_NO_MAIN
+// `--shm-read <name> [date flight]`: lists the flights in a shared
+// availability segment with their free seats, or one flight's free seats
+static bool readSharedAvailability(const string& name, const vector<string>& flight) {
+    try {
+        AvailabilityReader reader(name);
+        if (flight.empty()) {
+            for (const auto* entry : reader.flights()) {
+                size_t freeCount = 0;
+                reader.read(*entry, &freeCount);
+                Console() << string(entry->key) << ": " << freeCount << " seats free\n";
+            }
+            return true;
+        }
+        const auto* entry = reader.find(flight[0], flight[1]);
+        if (!entry) {
+            Console() << "Flight not found.\n";
+            return false;
+        }
+        size_t freeCount = 0;
+        AvailabilitySegment::Geometry geometry;
+        SeatBitmap availability = reader.read(*entry, &freeCount, &geometry);
+        Console() << "Available seats for flight " << flight[1] << " on " << flight[0] << " (" << freeCount << " free):\n";
+        Console line;
+        availability.forEachSet([&](size_t index) {
+            int row;
+            char letter;
+            AvailabilityReader::seatAt(geometry, index, row, letter);
+            line << "Seat " << row << letter << "\n";
+        });
+        return true;
+    } catch (const exception& e) {
+        Console() << e.what() << "\n";
+        return false;
+    }
+}
+
+// `--load-snapshot <file>`: starts from a file written by bgsave
+static bool loadSnapshotFile(Program& program, const string& path) {
+    try {
+        File file(path.c_str(), O_RDONLY);
+        string data;
+        char chunk[65536];
+        ssize_t bytesRead;
+        while ((bytesRead = file.read(chunk, sizeof(chunk))) > 0) data.append(chunk, bytesRead);
+        size_t magicLength = sizeof(Program::SnapshotMagic) - 1;
+        if (bytesRead < 0 || data.compare(0, magicLength, Program::SnapshotMagic) != 0) {
+            Console() << path << " is not a bgsave snapshot.\n";
+            return false;
+        }
+        program.loadSnapshot(data.substr(magicLength));
+        Console() << "Loaded snapshot " << path << ".\n";
+        return true;
+    } catch (const exception& e) {
+        Console() << "Could not load snapshot " << path << ": " << e.what() << "\n";
+        return false;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string configPath = "/Users/yelyzaveta/CLionProjects/oop_airflight/oop_airfligth/config.txt";
+    string primarySocket, followSocket;
+    bool pipelined = false;
+    size_t parallelThreads = 0;
+    string recordPath, replayPath;
+    double replaySpeed = 1.0;
+    int servePort = 0, targetPort = 0;
+    size_t benchThreads = 0;
+    double benchSeconds = 1.0;
+    string checkpointDir;
+    double checkpointInterval = 0;
+    string shmName, shmReadName, arenaName, snapshotPath;
+    vector<string> shmReadFlight;
+    LoadGenerator::Options load;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--primary" && i + 1 < argc) {
+            primarySocket = argv[++i];
+        } else if (arg == "--follow" && i + 1 < argc) {
+            followSocket = argv[++i];
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (arg == "--speed" && i + 1 < argc) {
+            string speed = argv[++i];
+            replaySpeed = speed == "max" ? 0.0 : stod(speed);
+        } else if (arg == "--state-arena" && i + 1 < argc) {
+            arenaName = argv[++i];
+        } else if (arg == "--load-snapshot" && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        } else if (arg == "--shm-availability" && i + 1 < argc) {
+            shmName = argv[++i];
+        } else if (arg == "--shm-read" && i + 1 < argc) {
+            shmReadName = argv[++i];
+            if (i + 2 < argc && argv[i + 1][0] != '-') {
+                shmReadFlight = {argv[i + 1], argv[i + 2]};
+                i += 2;
+            }
+        } else if (arg == "--checkpoint-dir" && i + 1 < argc) {
+            checkpointDir = argv[++i];
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpointInterval = stod(argv[++i]);
+        } else if (arg == "--target" && i + 1 < argc) {
+            targetPort = stoi(argv[++i]);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            servePort = stoi(argv[++i]);
+        } else if (arg == "--loadgen" && i + 1 < argc) {
+            load.port = stoi(argv[++i]);
+        } else if (arg == "--connections" && i + 1 < argc) {
+            load.connections = stoul(argv[++i]);
+        } else if (arg == "--duration" && i + 1 < argc) {
+            load.seconds = benchSeconds = stod(argv[++i]);
+        } else if (arg == "--rate" && i + 1 < argc) {
+            load.rate = stod(argv[++i]);
+        } else if (arg == "--zipf" && i + 1 < argc) {
+            load.zipf = stod(argv[++i]);
+        } else if (arg == "--mix" && i + 1 < argc) {
+            load.mix = LoadGenerator::parseMix(argv[++i]);
+        } else if (arg == "--hdr" && i + 1 < argc) {
+            load.hdrPath = argv[++i];
+        } else if (arg == "--bench-contention") {
+            benchThreads = max(thread::hardware_concurrency(), 1u) * 4;
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) benchThreads = stoul(argv[++i]);
+        } else if (arg == "--curve") {
+            load.curve = true;
+        } else if (arg == "--pipeline") {
+            pipelined = true;
+        } else if (arg == "--parallel") {
+            parallelThreads = max(thread::hardware_concurrency(), 1u);
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) parallelThreads = stoul(argv[++i]);
+        } else {
+            configPath = arg;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
 
-int main() {
-    Program program("/Users/yelyzaveta/CLionProjects/oop_airflight/oop_airfligth/config.txt");
+    ConsoleWriter console(STDOUT_FILENO);  // declared first so it flushes last
+    if (benchThreads) {
+        ContentionBenchmark(benchThreads, benchSeconds).run();
+        return 0;
+    }
+    if (load.port) {
+        return LoadGenerator(ConfigReader().parseConfig(configPath), load).run() ? 0 : 1;
+    }
+    if (!shmReadName.empty()) {
+        return readSharedAvailability(shmReadName, shmReadFlight) ? 0 : 1;
+    }
+    // Declared before the Program so Airplanes never outlive their slots
+    unique_ptr<AvailabilitySegment> availabilitySegment;
+    if (!shmName.empty()) {
+        try {
+            availabilitySegment.reset(new AvailabilitySegment(shmName));
+        } catch (const exception& e) {
+            Console() << "Shared availability unavailable: " << e.what() << "\n";
+        }
+    }
+    unique_ptr<StateArena> stateArena;
+    if (!arenaName.empty()) {
+        try {
+            stateArena.reset(new StateArena(arenaName));
+        } catch (const exception& e) {
+            Console() << "State arena unavailable: " << e.what() << "\n";
+        }
+        if (stateArena && stateArena->ownedByOtherProcess()) {
+            Console() << "State arena " << arenaName << " is in use by another process; running without it.\n";
+            stateArena.reset();
+        }
+    }
+    FlightSchedule schedule;
+    try {
+        schedule = ConfigReader().parseSchedule(configPath);
+    } catch (const exception& e) {
+        Console() << "Config error in " << configPath << ": " << e.what() << "\n";
+        return 1;
+    }
+    Program program(schedule, configPath);
+    if (availabilitySegment) program.setAvailabilitySegment(availabilitySegment.get());
+    // Recovery order: state arena, then checkpoints, then a bgsave snapshot
+    bool recovered = stateArena && program.resumeFromArena(*stateArena);
+    program.registerStats("output", [&console] { console.report(); });
+    ConfigWatcher watcher(configPath, [&program] { program.reloadConfig(); });
+    ReplicationLog replicationLog;
+    unique_ptr<ReplicationPrimary> primary;
+    unique_ptr<ReplicationFollower> follower;
+    if (!primarySocket.empty()) {
+        program.setReplicationLog(&replicationLog);
+        primary.reset(new ReplicationPrimary(program, replicationLog, primarySocket));
+    } else if (!followSocket.empty()) {
+        follower.reset(new ReplicationFollower(program, followSocket));
+    }
+    unique_ptr<CheckpointStore> checkpointStore;
+    unique_ptr<Checkpointer> checkpointer;
+    if (!checkpointDir.empty()) {
+        checkpointStore.reset(new CheckpointStore(checkpointDir));
+        if (!recovered && checkpointStore->hasBase()) {
+            try {
+                program.restoreCheckpoint(*checkpointStore);
+                recovered = true;
+            } catch (const exception& e) {
+                Console() << "Could not restore checkpoint from " << checkpointDir << ": " << e.what() << "\n";
+            }
+        }
+        program.setCheckpointStore(checkpointStore.get());
+        if (checkpointInterval > 0) checkpointer.reset(new Checkpointer(program, checkpointInterval));
+    }
+    if (!recovered && !snapshotPath.empty()) loadSnapshotFile(program, snapshotPath);
+    if (stateArena) program.setStateArena(stateArena.get());
     InputReader inputReader;
+    unique_ptr<CommandRecorder> recorder;
+    if (!recordPath.empty()) {
+        recorder.reset(new CommandRecorder(recordPath));
+        inputReader.setRecorder(recorder.get());
+    }
+    unique_ptr<CommandServer> server;
+    if (servePort) server.reset(new CommandServer(program, inputReader, servePort));
+
+    if (!replayPath.empty()) {
+        unique_ptr<ServerConnection> target;
+        if (targetPort) target.reset(new ServerConnection(targetPort));
+        return TraceReplayer(program, inputReader, target.get()).run(replayPath, replaySpeed) ? 0 : 1;
+    }
+    if (parallelThreads) {
+        ParallelBatch batch(program, inputReader, parallelThreads);
+        batch.run(cin);
+        return 0;
+    }
+    if (pipelined) {
+        CommandPipeline pipeline(program, inputReader, console);
+        pipeline.run(cin);
+        return 0;
+    }
 
     string input;
     while (true) {
-        cout << "Enter a command (check, book, return, view, exit): ";
+        Console() << Console::literal(commandPrompt);
         getline(cin, input);
 
         if (input == "exit") {
@@ -481,4 +6607,5 @@ int main() {
 
     return 0;
 };
+#endif
 
@@ -0,0 +1,97 @@
+// State arena: a restarted Program resumes from it, and attach refuses an
+// arena whose header or lists were damaged
+#include "check.h"
+
+// A second mapping of the arena's shared memory, for damaging it behind
+// StateArena's back
+struct RawArena {
+    size_t size = 0;
+    char* base = nullptr;
+    StateArena::Header* header = nullptr;
+
+    explicit RawArena(const string& name) {
+        File object(shm_open(name.c_str(), O_RDWR, 0600));
+        struct stat info;
+        if (fstat(object.getFileDescriptor(), &info) != 0) throw runtime_error("fstat " + name);
+        size = size_t(info.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, object.getFileDescriptor(), 0);
+        if (mapping == MAP_FAILED) throw runtime_error("mmap " + name);
+        base = static_cast<char*>(mapping);
+        header = reinterpret_cast<StateArena::Header*>(base);
+    }
+
+    ~RawArena() {
+        munmap(base, size);
+    }
+
+    template <typename T>
+    T* at(StateArena::ArenaPtr<T> pointer) {
+        return reinterpret_cast<T*>(base + pointer.offset);
+    }
+};
+
+// Attaches a fresh StateArena and checks it is refused for `expected`
+static bool refused(const string& name, const string& expected) {
+    StateArena arena(name);
+    StateArena::Contents contents;
+    string reason;
+    return !arena.attach(contents, reason) && reason.find(expected) != string::npos;
+}
+
+// Applies `damage`, checks attach refuses the arena, then undoes it
+template <typename Fn>
+static bool refusedAfter(const string& name, const string& expected, Fn damage) {
+    RawArena raw(name);
+    string saved(raw.base, raw.header->used);
+    damage(raw);
+    bool result = refused(name, expected);
+    memcpy(raw.base, saved.data(), saved.size());
+    return result;
+}
+
+int main() {
+    ConsoleWriter console(STDOUT_FILENO);
+    string name = "/airflight-arena-test-" + to_string(getpid());
+    vector<FlightSpec> flights{{"01.01.2025", "AA1", 2, {{1, 2, 1000}}}};
+    {
+        StateArena arena(name, size_t(1) << 20);
+        Program program(flights);
+        program.setStateArena(&arena);
+        program.deposit("Ann", 5000);
+        program.deposit("Bob", 5000);
+        program.bookTicket("AA1", "01.01.2025", "1", 'A', "Ann");
+        program.bookTicket("AA1", "01.01.2025", "1", 'B', "Bob");
+        program.returnTicket(2);  // leaves one record on the free list
+    }
+
+    CHECK(refusedAfter(name, "middle of an update", [](RawArena& raw) { ++raw.header->generation; }));
+    CHECK(refusedAfter(name, "incompatible build", [](RawArena& raw) { ++raw.header->version; }));
+    CHECK(refusedAfter(name, "passenger list tail", [](RawArena& raw) {
+        raw.header->lastPassenger = raw.header->firstPassenger;
+    }));
+    CHECK(refusedAfter(name, "damaged ticket list", [](RawArena& raw) {
+        auto* flight = raw.at(raw.header->firstFlight);
+        raw.at(flight->firstTicket)->prev = flight->firstTicket;
+    }));
+    CHECK(refusedAfter(name, "damaged free list", [](RawArena& raw) {
+        raw.at(raw.header->freeTickets)->next = raw.header->freeTickets;
+    }));
+    CHECK(refusedAfter(name, "damaged free list", [](RawArena& raw) {
+        raw.header->freeTickets = raw.at(raw.header->firstFlight)->firstTicket;  // a live ticket
+    }));
+
+    // Undamaged, it resumes with balances, tickets and the ticket counter
+    {
+        StateArena arena(name);
+        Program restored(flights);
+        CHECK(restored.resumeFromArena(arena));
+        Passenger* ann = restored.findPassenger("Ann");
+        Passenger* bob = restored.findPassenger("Bob");
+        CHECK(ann && ann->balance == 4000 && ann->tickets.size() == 1 && ann->tickets[0].ticketID == 1);
+        CHECK(bob && bob->balance == 5000 && bob->tickets.empty());
+        restored.bookTicket("AA1", "01.01.2025", "1", 'B', "Bob");
+        CHECK(bob && bob->tickets.size() == 1 && bob->tickets[0].ticketID == 3);
+    }
+    shm_unlink(name.c_str());
+    return checkResult();
+}
@@ -0,0 +1,37 @@
+// Minimal checks shared by the unit tests. Each test is its own binary
+// that compiles the program in (main.cpp with AIRFLIGHT_NO_MAIN), runs its
+// checks and exits non-zero when any failed.
+#ifndef AIRFLIGHT_TESTS_CHECK_H
+#define AIRFLIGHT_TESTS_CHECK_H
+
+#define AIRFLIGHT_NO_MAIN
+#include "../main.cpp"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            Console() << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+            ++failures;                                                                   \
+        }                                                                                 \
+    } while (0)
+
+// True when `fn` throws an E
+template <typename E, typename Fn>
+static bool throws(Fn fn) {
+    try {
+        fn();
+    } catch (const E&) {
+        return true;
+    } catch (...) {
+    }
+    return false;
+}
+
+static int checkResult() {
+    Console() << (failures ? to_string(failures) + " check(s) failed\n" : string("All checks passed\n"));
+    return failures ? 1 : 0;
+}
+
+#endif
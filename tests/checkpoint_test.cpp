@@ -0,0 +1,92 @@
+// Incremental checkpoints: image merge and encoding, and a restart from a
+// base plus deltas
+#include "check.h"
+
+static CheckpointImage::FlightState flightState(const string& flightNumber, vector<CheckpointImage::TicketState> tickets) {
+    return CheckpointImage::FlightState{"01.01.2025", flightNumber, move(tickets)};
+}
+
+static void testMergeAndEncode() {
+    CheckpointImage base;
+    base.sequence = 1;
+    base.lastTicketID = 7;
+    base.flights[flightKey("01.01.2025", "AA1")] = flightState("AA1", {{3, 1, 'A', "Ann", 1000}});
+    base.flights[flightKey("01.01.2025", "BB2")] = flightState("BB2", {{4, 2, 'B', "Bob", 2000}});
+    base.balances["Ann"] = 500;
+    base.balances["Bob"] = 600;
+
+    // A delta replaces whole flights and single balances, and never lowers the counter
+    CheckpointImage delta;
+    delta.sequence = 2;
+    delta.lastTicketID = 5;
+    delta.flights[flightKey("01.01.2025", "AA1")] = flightState("AA1", {});
+    delta.balances["Ann"] = 1500;
+    base.merge(move(delta));
+    CHECK(base.sequence == 2);
+    CHECK(base.lastTicketID == 7);
+    CHECK(base.flights.at(flightKey("01.01.2025", "AA1")).tickets.empty());
+    CHECK(base.flights.at(flightKey("01.01.2025", "BB2")).tickets.size() == 1);
+    CHECK(base.balances.at("Ann") == 1500 && base.balances.at("Bob") == 600);
+
+    CheckpointImage decoded = CheckpointImage::decode(base.encode(CheckpointStore::BaseMagic), CheckpointStore::BaseMagic);
+    CHECK(decoded.sequence == 2 && decoded.lastTicketID == 7);
+    CHECK(decoded.flights.size() == 2 && decoded.balances == base.balances);
+    const auto& ticket = decoded.flights.at(flightKey("01.01.2025", "BB2")).tickets.at(0);
+    CHECK(ticket.ticketID == 4 && ticket.row == 2 && ticket.letter == 'B' && ticket.passengerName == "Bob" &&
+          ticket.price == 2000);
+
+    // A base is not accepted where a delta is expected
+    string encoded = base.encode(CheckpointStore::BaseMagic);
+    CHECK(throws<runtime_error>([&] { CheckpointImage::decode(encoded, CheckpointStore::DeltaMagic); }));
+}
+
+static void removeStore(const CheckpointStore& store) {
+    for (const char* name : {"/base.ckpt", "/base.ckpt.tmp"}) unlink((store.path() + name).c_str());
+    store.dropDeltas(numeric_limits<uint64_t>::max());
+    rmdir(store.path().c_str());
+}
+
+// A base, then a delta with a return and a new booking; a fresh Program
+// restores the merged state and keeps issuing IDs above the saved ones
+static void testRestore() {
+    char directory[] = "/tmp/airflight-checkpoint-XXXXXX";
+    CHECK(mkdtemp(directory) != nullptr);
+    CheckpointStore store(directory);
+    vector<FlightSpec> flights{{"01.01.2025", "AA1", 2, {{1, 2, 1000}}}};
+    {
+        Program program(flights);
+        program.setCheckpointStore(&store);
+        program.deposit("Ann", 5000);
+        program.bookTicket("AA1", "01.01.2025", "1", 'A', "Ann");
+        program.bookTicket("AA1", "01.01.2025", "1", 'B', "Ann");
+        CHECK(program.checkpoint(false));
+        program.returnTicket(2);
+        program.bookTicket("AA1", "01.01.2025", "2", 'A', "Ann");
+        CHECK(program.checkpoint(false));
+        CHECK(store.hasBase() && store.deltas().size() == 1);
+    }
+
+    Program restored(flights);
+    restored.restoreCheckpoint(store);
+    Passenger* ann = restored.findPassenger("Ann");
+    CHECK(ann && ann->balance == 3000);
+    CHECK(ann && ann->tickets.size() == 2);
+    Ticket ticket;
+    CHECK(ann && ann->findTicket(1, ticket) && ticket.seat.row == 1 && ticket.seat.letter() == 'A');
+    CHECK(ann && ann->findTicket(3, ticket) && ticket.seat.row == 2 && ticket.seat.letter() == 'A');
+    CHECK(ann && !ann->findTicket(2, ticket));
+
+    // 1B was returned before the delta and is free again; 1A is still taken
+    restored.bookTicket("AA1", "01.01.2025", "1", 'A', "Ann");
+    CHECK(ann && ann->tickets.size() == 2);
+    restored.bookTicket("AA1", "01.01.2025", "1", 'B', "Ann");
+    CHECK(ann && ann->tickets.size() == 3 && ann->tickets.back().ticketID == 4);
+    removeStore(store);
+}
+
+int main() {
+    ConsoleWriter console(STDOUT_FILENO);
+    testMergeAndEncode();
+    testRestore();
+    return checkResult();
+}
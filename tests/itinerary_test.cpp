@@ -0,0 +1,60 @@
+// Itinerary booking is all or nothing: a failed itinerary leaves every
+// seat and balance as it found them
+#include "check.h"
+
+static Cents balanceOf(Program& program, const string& name) {
+    Passenger* passenger = program.findPassenger(name);
+    return passenger ? passenger->balance : -1;
+}
+
+static void testRollback() {
+    vector<FlightSpec> specs = {
+        {"01.01.2025", "AA1", 2, {{1, 1, 10000}}},
+        {"02.01.2025", "BB2", 2, {{1, 1, 10000}}},
+    };
+    Program program(specs);
+    shared_ptr<Airplane> first = program.findAirplane("AA1", "01.01.2025");
+    shared_ptr<Airplane> second = program.findAirplane("BB2", "02.01.2025");
+    vector<ItineraryLeg> legs = {{"01.01.2025", "AA1", 1, 'A'}, {"02.01.2025", "BB2", 1, 'A'}};
+
+    // Enough for one leg only
+    program.deposit("Ann", 15000);
+    program.bookItinerary("Ann", legs);
+    CHECK(first->isSeatAvailable(1, 'A') && second->isSeatAvailable(1, 'A'));
+    CHECK(balanceOf(program, "Ann") == 15000);
+    CHECK(program.findPassenger("Ann")->tickets.empty());
+
+    // Second leg already taken
+    program.deposit("Bob", 10000);
+    program.bookTicket("BB2", "02.01.2025", "1", 'B', "Bob");
+    vector<ItineraryLeg> blocked = {{"01.01.2025", "AA1", 1, 'A'}, {"02.01.2025", "BB2", 1, 'B'}};
+    program.deposit("Ann", 5000);
+    program.bookItinerary("Ann", blocked);
+    CHECK(first->isSeatAvailable(1, 'A') && !second->isSeatAvailable(1, 'B'));
+    CHECK(balanceOf(program, "Ann") == 20000);
+    CHECK(program.findPassenger("Ann")->tickets.empty());
+
+    // Both legs free and paid for
+    program.bookItinerary("Ann", legs);
+    CHECK(!first->isSeatAvailable(1, 'A') && !second->isSeatAvailable(1, 'A'));
+    CHECK(balanceOf(program, "Ann") == 0);
+    CHECK(program.findPassenger("Ann")->tickets.size() == 2);
+}
+
+// Seat rows that do not fit a Seat are rejected rather than thrown on
+static void testParseRow() {
+    int row = -1;
+    CHECK(parseRow("12", row) && row == 12);
+    CHECK(parseRow("65535", row) && row == 65535);
+    CHECK(!parseRow("65536", row));
+    CHECK(!parseRow("99999999999999999999", row));
+    CHECK(!parseRow("", row));
+    CHECK(!parseRow("1x", row));
+}
+
+int main() {
+    ConsoleWriter console(STDOUT_FILENO);
+    testRollback();
+    testParseRow();
+    return checkResult();
+}
@@ -0,0 +1,44 @@
+// Cents parsing and balance limits
+#include "check.h"
+
+static void testParseCents() {
+    CHECK(parseCents("100") == 10000);
+    CHECK(parseCents("100$") == 10000);
+    CHECK(parseCents("$99.5") == 9950);
+    CHECK(parseCents("0.07") == 7);
+    CHECK(parseCents("000000000000000000000012.50") == 1250);
+    CHECK(parseCents("92233720368547757.99") == Cents(9223372036854775799));  // the largest accepted
+    CHECK(throws<invalid_argument>([] { parseCents(""); }));
+    CHECK(throws<invalid_argument>([] { parseCents("1.234"); }));
+    CHECK(throws<invalid_argument>([] { parseCents("-5"); }));
+    // Would wrap when multiplied by 100, or not fit stoll at all
+    CHECK(throws<invalid_argument>([] { parseCents("999999999999999999"); }));
+    CHECK(throws<invalid_argument>([] { parseCents("92233720368547758"); }));
+    CHECK(throws<invalid_argument>([] { parseCents("99999999999999999999"); }));
+}
+
+// A deposit that would overflow the balance, counting refunds the
+// passenger's tickets can still bring, is refused and changes nothing
+static void testDepositOverflow() {
+    Program program(vector<FlightSpec>{{"01.01.2025", "AA1", 2, {{1, 1, 10000}}}});
+    Cents nearMax = numeric_limits<Cents>::max() - 5000;
+    program.deposit("Ann", nearMax);
+    CHECK(program.findPassenger("Ann")->balance == nearMax);
+    program.deposit("Ann", 10000);
+    CHECK(program.findPassenger("Ann")->balance == nearMax);
+
+    // After booking, the ticket's refund counts against the limit
+    program.bookTicket("AA1", "01.01.2025", "1", 'A', "Ann");
+    CHECK(program.findPassenger("Ann")->balance == nearMax - 10000);
+    program.deposit("Ann", 6000);
+    CHECK(program.findPassenger("Ann")->balance == nearMax - 10000);
+    program.deposit("Ann", 5000);
+    CHECK(program.findPassenger("Ann")->balance == nearMax - 5000);
+}
+
+int main() {
+    ConsoleWriter console(STDOUT_FILENO);
+    testParseCents();
+    testDepositOverflow();
+    return checkResult();
+}
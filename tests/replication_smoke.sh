@@ -0,0 +1,91 @@
+#!/usr/bin/env bash
+# Two-process replication smoke test: a primary takes bookings, a follower
+# replays them over the Unix socket, and both must end up showing the same
+# seats and tickets with the follower's lag back at zero.
+#
+# Usage: replication_smoke.sh <oop_airflight binary> <config file>
+set -u
+
+binary=$1
+config=$2
+work=$(mktemp -d)
+socket=$work/replication.sock
+primary_pid=
+follower_pid=
+
+cleanup() {
+    exec 3>&- 4>&-
+    [ -n "$primary_pid" ] && kill "$primary_pid" 2>/dev/null
+    [ -n "$follower_pid" ] && kill "$follower_pid" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$work"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*"
+    echo "--- primary output"; cat "$work/primary.out"
+    echo "--- follower output"; cat "$work/follower.out"
+    exit 1
+}
+
+# Output of one command, without the prompt
+ask() {
+    local fd=$1 file=$2 command=$3
+    local before
+    before=$(wc -c < "$file")
+    echo "$command" >&"$fd"
+    sleep 0.2
+    tail -c +"$((before + 1))" "$file" | sed 's/^Enter a command[^:]*: //'
+}
+
+# Repeats `command` on the follower until its output contains `expected`
+await_follower() {
+    local command=$1 expected=$2
+    for _ in $(seq 50); do
+        if ask 4 "$work/follower.out" "$command" | grep -qF -- "$expected"; then
+            return 0
+        fi
+    done
+    fail "follower never showed '$expected' for '$command'"
+}
+
+mkfifo "$work/primary.in" "$work/follower.in"
+"$binary" --primary "$socket" "$config" < "$work/primary.in" > "$work/primary.out" 2>&1 &
+primary_pid=$!
+exec 3> "$work/primary.in"
+for _ in $(seq 50); do
+    [ -S "$socket" ] && break
+    sleep 0.1
+done
+[ -S "$socket" ] || fail "primary never opened $socket"
+
+"$binary" --follow "$socket" "$config" < "$work/follower.in" > "$work/follower.out" 2>&1 &
+follower_pid=$!
+exec 4> "$work/follower.in"
+
+echo "deposit Ann 1000" >&3
+echo "book 11.12.2022 FQ12 1A Ann" >&3
+echo "book 11.12.2022 FQ12 2C Ann" >&3
+echo "return 1" >&3
+sleep 0.3
+
+await_follower "view ID 2" "Ticket ID: 2, Passenger: Ann"
+await_follower "stats replication" "lag 0 mutation(s)"
+
+primary_check=$(ask 3 "$work/primary.out" "check 11.12.2022 FQ12")
+follower_check=$(ask 4 "$work/follower.out" "check 11.12.2022 FQ12")
+[ "$primary_check" = "$follower_check" ] || fail "check output differs between primary and follower"
+echo "$follower_check" | grep -q "Seat 1A is available" || fail "returned seat 1A is not free on the follower"
+echo "$follower_check" | grep -q "Seat 2C is available" && fail "booked seat 2C is free on the follower"
+
+primary_view=$(ask 3 "$work/primary.out" "view username Ann")
+follower_view=$(ask 4 "$work/follower.out" "view username Ann")
+[ "$primary_view" = "$follower_view" ] || fail "view output differs between primary and follower"
+
+ask 4 "$work/follower.out" "book 11.12.2022 FQ12 3A Ann" | grep -q "Read-only replica" ||
+    fail "follower accepted a booking"
+
+echo "exit" >&4
+echo "exit" >&3
+echo "PASS"
@@ -0,0 +1,57 @@
+// Schedule rules: strict dates, and scheduled flights built only by
+// bookings, never by reads
+#include "check.h"
+
+static void testParseDate() {
+    int64_t day = -1;
+    CHECK(parseDate("01.01.1970", day) && day == 0);
+    CHECK(parseDate("29.02.2024", day) && day == 19782);
+    CHECK(!parseDate("29.02.2025", day));
+    CHECK(!parseDate("32.01.2025", day));
+    CHECK(!parseDate("01.13.2025", day));
+    CHECK(!parseDate("00.01.2025", day));
+    // Loose spellings of a valid date would key a second Airplane
+    CHECK(!parseDate("1.1.2025", day));
+    CHECK(!parseDate("01.01.2025xyz", day));
+    CHECK(!parseDate(" 01.01.2025", day));
+    CHECK(!parseDate("01-01-2025", day));
+}
+
+static size_t builtFlights(Program& program) {
+    return program.currentFlights()->flights.size();
+}
+
+static void testReadsDoNotInstantiate() {
+    FlightSchedule schedule;
+    ScheduleRule rule;
+    CHECK(parseDate("01.01.2025", rule.firstDay) && parseDate("31.12.2025", rule.lastDay));
+    rule.flightNumber = "QQ7";
+    rule.stepDays = 1;
+    rule.shape = FlightSpec{"", "QQ7", 2, {{1, 1, 1000}}};
+    rule.blank = ConfigReader::buildAirplane(rule.shape);
+    schedule.rules.push_back(rule);
+    Program program(schedule);
+
+    const Airplane* seen = program.findAirplaneForRead("QQ7", "05.03.2025");
+    CHECK(seen && seen->availableSeatCount() == 2);
+    program.checkAvailability("QQ7", "05.03.2025");
+    CHECK(builtFlights(program) == 0);
+
+    program.deposit("Ann", 10000);
+    program.bookTicket("QQ7", "5.3.2025", "1", 'A', "Ann");
+    program.bookTicket("QQ7", "05.03.2025xyz", "1", 'A', "Ann");
+    CHECK(builtFlights(program) == 0);
+    program.bookTicket("QQ7", "05.03.2025", "1", 'A', "Ann");
+    program.bookTicket("QQ7", "05.03.2025", "1", 'A', "Ann");
+    CHECK(builtFlights(program) == 1);
+    CHECK(program.findPassenger("Ann")->tickets.size() == 1);
+    seen = program.findAirplaneForRead("QQ7", "05.03.2025");
+    CHECK(seen && seen->availableSeatCount() == 1);
+}
+
+int main() {
+    ConsoleWriter console(STDOUT_FILENO);
+    testParseDate();
+    testReadsDoNotInstantiate();
+    return checkResult();
+}
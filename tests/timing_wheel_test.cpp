@@ -0,0 +1,56 @@
+// Timing-wheel expiry: timers fire on exactly their tick, at every wheel
+// level, and cancelled ones never fire
+#include "check.h"
+
+static void testExpiryAtEveryLevel() {
+    TimingWheel wheel;
+    vector<pair<uint64_t, uint64_t>> fired;  // tick, payload
+    auto expire = [&](uint64_t payload) { fired.emplace_back(wheel.currentTick(), payload); };
+
+    wheel.schedule(5, 1);
+    wheel.schedule(300, 2);        // second level
+    wheel.schedule(70000, 3);      // third level
+    TimingWheel::TimerId cancelled = wheel.schedule(10, 4);
+    wheel.cancel(cancelled);
+    CHECK(wheel.size() == 3);
+
+    wheel.advance(4, expire);
+    CHECK(fired.empty());
+    wheel.advance(5, expire);
+    CHECK(fired.size() == 1 && fired[0] == make_pair(uint64_t(5), uint64_t(1)));
+    wheel.advance(299, expire);
+    CHECK(fired.size() == 1);
+    wheel.advance(300, expire);
+    CHECK(fired.size() == 2 && fired[1] == make_pair(uint64_t(300), uint64_t(2)));
+    wheel.advance(69999, expire);
+    CHECK(fired.size() == 2);
+    wheel.advance(70000, expire);
+    CHECK(fired.size() == 3 && fired[2] == make_pair(uint64_t(70000), uint64_t(3)));
+    CHECK(wheel.size() == 0);
+
+    // A timer already due fires on the next tick
+    wheel.schedule(100, 5);
+    wheel.advance(70001, expire);
+    CHECK(fired.size() == 4 && fired[3] == make_pair(uint64_t(70001), uint64_t(5)));
+}
+
+// Freed timer nodes are reused without resurrecting old timers
+static void testCancelAndReuse() {
+    TimingWheel wheel;
+    vector<uint64_t> fired;
+    auto expire = [&](uint64_t payload) { fired.push_back(payload); };
+    TimingWheel::TimerId first = wheel.schedule(20, 1);
+    wheel.cancel(first);
+    wheel.cancel(first);  // a second cancel is harmless
+    wheel.schedule(20, 2);
+    wheel.advance(20, expire);
+    CHECK(fired == vector<uint64_t>{2});
+    CHECK(wheel.size() == 0);
+}
+
+int main() {
+    ConsoleWriter console(STDOUT_FILENO);
+    testExpiryAtEveryLevel();
+    testCancelAndReuse();
+    return checkResult();
+}